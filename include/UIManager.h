@@ -27,11 +27,17 @@
 #include <sstream>
 #include <csignal>
 #include <mutex>
+#include <thread>
 
-struct ColoredLine {
-    std::string text;
-    int color_pair;
-};
+#include "scrollback.h"
+
+// Headless output is written once this many bytes are buffered, or when flush() is called.
+#define HEADLESS_FLUSH_BYTES 65536
+
+// Buffer 0 collects every line that is not printed to a buffer of its own.
+#define STATUS_BUFFER 0
+// Target of a line printed without one: the active buffer from the UI thread, else the status buffer.
+#define NO_BUFFER static_cast<size_t>(-1)
 
 // Color enums for clean usage
 enum NcColor {
@@ -51,6 +57,10 @@ inline int& ncurses_tls_color() {
     thread_local int c = NC_DEFAULT;
     return c;
 }
+inline size_t& ncurses_tls_target() {
+    thread_local size_t b = NO_BUFFER;
+    return b;
+}
 }  // namespace detail
 
 class UIManager {
@@ -59,20 +69,50 @@ private:
     WINDOW* header_win;
     WINDOW* input_win;
     int term_height, term_width;
-    std::vector<ColoredLine> log_lines;
-    int scroll_offset;
+
+    /// One window's worth of output. Only the active buffer is drawn; the others count
+    /// what arrived since they were last shown.
+    struct Buffer {
+        std::string name;
+        Scrollback lines;
+        int scroll_offset = 0;
+        unsigned int unread = 0;
+        unsigned int highlights = 0;  // Unread lines printed in NC_RED.
+        bool open = true;
+    };
+    std::vector<Buffer> buffers;   // Indexed by buffer id.
+    std::vector<size_t> free_buffers;  // Ids of closed buffers, reused by openBuffer().
+    size_t active = STATUS_BUFFER;
+    size_t scrollback_lines = DEFAULT_SCROLLBACK_LINES;
+    std::thread::id ui_thread;     // Untargeted lines from this thread go to the active buffer.
     std::string currentHeader;
+    bool header_dirty = false;
     mutable std::recursive_mutex display_mutex;
     bool output_dirty = false;
+    bool curses_active = false;
+    // Headless mode: printed lines go to out_fd through out_buffer instead of the windows.
+    bool headless = false;
+    int out_fd = -1;
+    std::string out_buffer;
 
-    void pushLogLineUnlocked(const std::string& line, int color);
-    std::vector<std::string> wrap_text(const std::string& text, int max_width);
+    void flushUnlocked();
+
+    void pushLogLineUnlocked(const std::string& line, int color, size_t target = NO_BUFFER);
+    void drawHeaderUnlocked();
 
     public:
     UIManager();
     ~UIManager();
 
+    // Splits text into pieces of at most max_width bytes, one per screen row.
+    static std::vector<std::string> wrap_text(std::string_view text, int max_width);
+
     void init();
+    // Runs without ncurses: output goes to fd, and every window call becomes a no-op.
+    void initHeadless(int fd);
+    bool isHeadless() const { return headless; }
+    // Writes out buffered headless output.
+    void flush();
     void shutdown();
     [[noreturn]] void fatal(const std::string& msg);
     void waitForExit();
@@ -82,6 +122,19 @@ private:
     void redrawInput(const std::string& input_line, int cursor_x = 3);
     void redrawOutput(bool force = false);
     void setHeader(const std::string& header);
+    void setScrollback(size_t lines);
+
+    // Creates a buffer with its own scrollback and returns its id, reusing a closed one's.
+    size_t openBuffer(const std::string& name);
+    // Frees a buffer's scrollback; if it was shown, the status buffer is shown instead.
+    void closeBuffer(size_t id);
+    void renameBuffer(size_t id, const std::string& name);
+    // Makes a buffer the visible one and clears its unread counters.
+    void switchBuffer(size_t id);
+    void nextBuffer(int step = 1);
+    size_t activeBuffer() const;
+    // Prints every buffer with its unread and highlight counts.
+    void listBuffers();
 
     void scrollUp(int lines = 1);
     void scrollDown(int lines = 1);
@@ -102,10 +155,11 @@ private:
     public:
         explicit NcursesStream(UIManager* p) : parent(p) { }
 
-        // Allow print(RED) syntax
-        NcursesStream& operator()(int color) {
+        // Allow print(RED) and print(RED, buffer) syntax
+        NcursesStream& operator()(int color, size_t target = NO_BUFFER) {
             std::lock_guard<std::recursive_mutex> lock(parent->display_mutex);
             detail::ncurses_tls_color() = color;
+            detail::ncurses_tls_target() = target;
             return *this;
         }
 
@@ -125,10 +179,10 @@ private:
                 detail::ncurses_tls_buf().str("");
                 detail::ncurses_tls_buf().clear();
                 int col = detail::ncurses_tls_color();
+                size_t target = detail::ncurses_tls_target();
                 detail::ncurses_tls_color() = NC_DEFAULT;
-                parent->pushLogLineUnlocked(line, col);
-                parent->scroll_offset = 0;
-                parent->output_dirty = true;
+                detail::ncurses_tls_target() = NO_BUFFER;
+                parent->pushLogLineUnlocked(line, col, target);
             }
             return *this;
         }
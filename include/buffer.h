@@ -0,0 +1,61 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/// Fixed-capacity receive buffer. The transport reads straight into the free tail, parsers
+/// consume from the front by advancing an offset, and the unread remainder (normally a partial
+/// line) is moved back to the start only when the tail needs room again.
+class RecvBuffer {
+public:
+    explicit RecvBuffer(size_t capacity) : storage(capacity) { }
+
+    char* WritePtr() { return storage.data() + tail; }
+    char* ReadPtr() { return storage.data() + head; }
+    size_t Writable() const { return storage.size() - tail; }
+    void Commit(size_t n) { tail += n; }
+
+    std::string_view Data() const { return std::string_view(storage.data() + head, tail - head); }
+    size_t Size() const { return tail - head; }
+    bool Empty() const { return head == tail; }
+    bool Full() const { return head == 0 && tail == storage.size(); }
+    size_t Capacity() const { return storage.size(); }
+
+    void Consume(size_t n) {
+        head += n;
+        if (head == tail)
+            head = tail = 0;
+    }
+
+    void Compact() {
+        if (head == 0)
+            return;
+        std::memmove(storage.data(), storage.data() + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+
+private:
+    std::vector<char> storage;
+    size_t head = 0;
+    size_t tail = 0;
+};
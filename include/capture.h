@@ -0,0 +1,98 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "wsdeflate.h"
+
+// Identifies a capture file and its format version.
+#define CAPTURE_MAGIC "TNCAP001"
+#define CAPTURE_MAGIC_SIZE 8
+// Records are buffered and written out once this many bytes are pending, and on Close().
+#define CAPTURE_FLUSH_BYTES 65536
+
+/// Capture file layout: CAPTURE_MAGIC, then records of
+///   type (1 byte), time since the previous record in ns (varint), length (varint), payload.
+/// The first record's time is relative to Open(). Varints are little-endian base 128.
+enum CaptureRecordType : uint8_t {
+    CAPTURE_DATA = 1,       // One read chunk, as returned by the transport (after TLS).
+    CAPTURE_WEBSOCKET = 2,  // WebSocket handshake done; payload holds the agreed deflate parameters.
+};
+
+/// Records the receive side of a connection. Used from the connection thread only.
+class CaptureWriter {
+public:
+    CaptureWriter() = default;
+    ~CaptureWriter() { Close(); }
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    // Truncates 'path'. Returns false with errno set on failure.
+    bool Open(const std::string& path);
+    bool IsOpen() const { return fd >= 0; }
+    void Close();
+
+    void Data(const char* data, size_t len);
+    void WebSocket(const WsDeflateConfig& agreed);
+    uint64_t Bytes() const { return bytes; }
+    // Returns true, once, after a failed write closed the file; 'err' receives its errno.
+    bool TakeError(int& err);
+
+private:
+    void Record(uint8_t type, const char* data, size_t len);
+    void Flush();
+
+    int fd = -1;
+    std::string pending;
+    uint64_t last_ns = 0;
+    uint64_t bytes = 0;
+    int error = 0;
+};
+
+/// Reads a capture file into memory and walks its records.
+class CaptureReader {
+public:
+    struct Record {
+        uint8_t type = 0;
+        uint64_t time_ns = 0;    // Since the capture was opened.
+        std::string_view data;   // Points into the reader; valid until it is destroyed.
+    };
+
+    // Returns false with a message in 'error' if the file cannot be read or is not a capture.
+    bool Open(const std::string& path, std::string& error);
+    // Returns false at the end of the file. A record cut short (e.g. by a crash while
+    // capturing) also ends the walk and sets Truncated().
+    bool Next(Record& out);
+    bool Truncated() const { return truncated; }
+
+    // Decodes a CAPTURE_WEBSOCKET payload.
+    static bool DecodeWebSocket(std::string_view data, WsDeflateConfig& agreed);
+
+private:
+    bool ReadVarint(uint64_t& value);
+
+    std::string contents;
+    size_t pos = 0;
+    uint64_t time_ns = 0;
+    bool truncated = false;
+};
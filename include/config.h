@@ -28,6 +28,8 @@ class ConfigParser {
 public:
     bool isValidFile(const std::string&);
     bool load(const std::string&, const std::string&);
+    // Whether the last load() found its section. Loading several sections merges them, later ones winning.
+    bool foundSection() const { return found_section; }
 
     template <typename T>
     T get(const std::string& key, const T& default_value) const {
@@ -38,6 +40,7 @@ public:
 
 private:
     std::unordered_map<std::string, std::string> config_map;
+    bool found_section = false;
 
     static void trim(std::string& str);
 
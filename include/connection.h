@@ -23,6 +23,10 @@
 #include <csignal>
 #include <mutex>
 #include <deque>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <poll.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -31,6 +35,14 @@
 #include "modules.h"
 #include "UIManager.h"
 #include "misc.h"
+#include "buffer.h"
+#include "ircmessage.h"
+#include "mpscqueue.h"
+#include "websocket.h"
+#include "wsdeflate.h"
+#include "capture.h"
+#include "stats.h"
+#include "eventloop.h"
 #include "defs.h"
 
 class Modules;
@@ -38,6 +50,23 @@ class Modules;
 // Externally defined in main.cpp
 extern volatile sig_atomic_t stop_program;
 
+// Seconds allowed for the TLS and WebSocket handshakes to complete.
+#define HANDSHAKE_TIMEOUT 10
+// Upper bound on reads per wakeup so a flood cannot starve the write side.
+#define MAX_READS_PER_WAKEUP 64
+// Default receive buffer size (the "recv_buffer" config key), and the smallest accepted value.
+#define DEFAULT_RECV_BUFFER 65536
+#define MIN_RECV_BUFFER 1024
+// Queued lines gathered into one writev() call, and bytes coalesced into one SSL_write() (a full TLS record).
+#define MAX_WRITE_IOVECS 64
+#define TLS_RECORD_SIZE 16384
+
+// A send queue or write buffer entry, stamped when it was queued.
+struct QueuedData {
+    std::string data;
+    uint64_t queued_ns = 0;
+};
+
 class ConnectionManager {
 public:
     ConnectionManager(  Modules* _mod, UIManager& _ui,
@@ -45,47 +74,116 @@ public:
                         bool useTLS,
                         std::string _caCertFile,
                         std::string _clientCertFile,
-                        std::string _clientKeyFile);
+                        std::string _clientKeyFile,
+                        size_t _recvBufferSize = DEFAULT_RECV_BUFFER,
+                        const WsDeflateConfig& _wsDeflate = WsDeflateConfig(),
+                        const std::string& _captureFile = "");
+    // Feeds a capture file through the receive path instead of connecting: as fast as possible,
+    // or at the recorded pacing. Anything sent is discarded. Stops the program when done.
+    ConnectionManager(  Modules* _mod, UIManager& _ui,
+                        Logger* _logger, const std::string& _replayFile, bool _replayPaced,
+                        size_t _recvBufferSize = DEFAULT_RECV_BUFFER);
     ~ConnectionManager();
 
+    // Runs the connection on a thread of its own. Connections that share a thread are added to
+    // an EventLoop instead, which then starts and stops them.
     void Start();
     void Stop();
     void SendData(const std::string& data);
+    // Queues pre-formatted CRLF-terminated lines as one write buffer entry, without echo or logging.
+    void SendRaw(std::string data, size_t lines);
+    // Makes the connection thread run another loop iteration, e.g. to pick up a new timer.
+    void Wakeup();
+    // True once the connection failed or was closed by the server.
+    bool Closed() const { return closed; }
+    // Bytes queued but not yet written. Connection thread only.
+    size_t WriteBacklog() const;
+    // Appends the stats report to 'file' every 'interval' seconds. Call before Start().
+    void SetStatsDump(const std::string& file, unsigned int interval);
+    // Prints the stats report. Safe from any thread.
+    void ReportStats();
+    // Labels echoed lines, log entries and stats dumps when several connections share the UI.
+    // Call before Start().
+    void SetName(const std::string& name);
 
 private:
-    void MainLoop();
+    friend class EventLoop;
+
+    // One event loop iteration for this connection; 'revents' holds its socket's poll() result.
+    void Process(short revents);
+    short PollEvents() const;
+    int PollTimeout() const;
+    // Last flush and reports, once the connection closed or the loop is stopping.
+    void Finish();
+    void ReplayLoop();
+    void DiscardSendQueue();
+    int DumpStatsIfDue();
+    void DrainSendQueue();
     void WriteBufferedData();
-    std::string receive_message(std::string &buffer);
-    void process_received_data(std::string &buffer);
+    void WriteBufferedPlain();
+    void WriteBufferedTLS();
+    void AdvanceWriteBuffer(size_t bytes);
+    void receive_message();
+    void process_received_data();
+    void parse_line(const IrcMessage& msg, uint64_t& now);
     bool PerformTLSHandshake();
     bool LoadCertificates();
     void cleanup_tls();
     bool PerformWebSocketHandshake();
     ssize_t transport_read(char* buf, size_t len);
     ssize_t transport_write(const char* buf, size_t len);
-    std::string encode_websocket_frame(const std::string& payload);
-    bool decode_websocket_frames(std::string& ws_buffer);
+    ssize_t transport_writev(const struct iovec* iov, int count);
+    void process_websocket_data();
+    void dispatch_websocket_message(std::string_view message);
+    void report_deflate_stats();
+    void capture_data(const char* data, size_t len);
+    void report_capture_error();
+    void queue_websocket_control(unsigned char opcode, std::string_view payload);
 
     Modules* mod;
     UIManager& ui;
     Logger* logger;
     HostConfig host;
+    std::string label;                    // "[name] ", or empty.
     int sockfd;
-    std::string buffer;
-    std::string ws_buffer;
-    std::deque<std::string> writeBuffer;
-    std::thread receive_thread;
+    EventLoop* loop = nullptr;
+    std::unique_ptr<EventLoop> own_loop;  // Set by Start().
+    std::atomic<bool> closed{false};
+    bool finished = false;
+    short handshake_events = POLLIN;
+    std::chrono::steady_clock::time_point handshake_deadline;
+    int timer_timeout = -1;               // Last Modules::OnTimer() result.
+    RecvBuffer buffer;
+    std::string ws_buffer;                // WebSocket handshake response.
+    MPSCQueue<QueuedData> sendQueue;      // Filled by SendData() from any thread.
+    std::deque<QueuedData> writeBuffer;   // Receive thread only; wire-ready data.
+    size_t write_offset = 0;              // Bytes of writeBuffer.front() already sent.
+    std::string tls_record;               // Coalesced lines pending in SSL_write().
+    std::vector<uint64_t> tls_record_queued;  // Queue times of the entries completed in tls_record.
+    ConnStats stats;
+    uint64_t read_ns = 0;                 // When the data being parsed was read.
+    int stats_fd = -1;
+    unsigned int stats_interval = DEFAULT_STATS_INTERVAL;
+    std::chrono::steady_clock::time_point next_stats_dump;
+    std::atomic<uint64_t> raw_extra_lines{0};  // SendRaw() entries count as one line each when flushed.
+    std::thread replay_thread;
+    CaptureWriter capture;
+    std::string replay_file;
+    bool replay_paced = false;
     bool websocket_mode = false;
     bool ws_handshake_done = false;
     std::string ws_key;
-    unsigned int ws_handshake_retries = 0;
+    WsMaskSource ws_masks;
+    WsDecoder ws_decoder;
+    WsDeflateConfig ws_deflate_offer_config;
+    WsDeflate ws_deflate;
+    std::string ws_scratch;               // Compressed or inflated message being processed.
 
     bool tls_enabled = false;
     bool tls_handshake_done = false;
     std::string caCertFile;
     std::string clientCertFile;
     std::string clientKeyFile;
-    unsigned int tls_handshake_retries = 0;
     SSL_CTX* ssl_ctx = nullptr;
     SSL* ssl = nullptr;
 };
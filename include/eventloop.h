@@ -0,0 +1,62 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <thread>
+#include <vector>
+
+#include "UIManager.h"
+
+class ConnectionManager;
+
+// Externally defined in main.cpp
+extern volatile sig_atomic_t stop_program;
+
+/// Runs any number of connections on one thread: a single poll() covers every socket, plus a
+/// self-pipe that SendData() and Stop() use to interrupt it. A connection that fails is finished
+/// on its own; the loop ends, and sets stop_program, once none is left.
+class EventLoop {
+public:
+    explicit EventLoop(UIManager& _ui);
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Connections must be added before Start().
+    void Add(ConnectionManager* conn);
+    void Start();
+    void Stop();
+
+    // Interrupts poll() unconditionally.
+    void Wakeup();
+    // Interrupts poll() unless a wakeup is already pending, so a burst of sends costs one pipe write.
+    void Notify();
+    bool OnLoopThread() const { return std::this_thread::get_id() == thread.get_id(); }
+
+private:
+    void Run();
+
+    UIManager& ui;
+    std::vector<ConnectionManager*> conns;
+    int wakeup_fds[2] = { -1, -1 };
+    std::atomic<bool> wakeup_pending{false};
+    std::thread thread;
+};
@@ -0,0 +1,68 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+// RFC 1459 allows at most 15 parameters; anything beyond is folded into the last one (as ircu does).
+#define IRC_MAX_PARAMS 15
+
+/// A tokenized IRC line. All fields are views into the line passed to parse_irc_message(),
+/// so the message is only valid for as long as that buffer is.
+struct IrcMessage {
+    std::string_view raw;      // Exact wire text, including IRCv3 @tags (for logs and the UI).
+    std::string_view tags;     // IRCv3 tag block without the leading '@', empty if absent.
+    std::string_view line;     // raw with the tag block stripped.
+    std::string_view source;   // Prefix without the leading ':', empty if absent.
+    std::string_view command;
+    std::array<std::string_view, IRC_MAX_PARAMS> params;
+    size_t param_count = 0;
+
+    std::string_view param(size_t i) const { return i < param_count ? params[i] : std::string_view(); }
+
+    // Nickname part of a nick!user@host source.
+    std::string_view nick() const { return source.substr(0, source.find_first_of("!@")); }
+};
+
+/// Splits an IRC line into tags, source, command and params without allocating.
+/// Returns false if the line has no command.
+bool parse_irc_message(std::string_view line, IrcMessage& msg);
+
+/// Parses each complete LF or CRLF terminated line of data in place and calls f(msg) for it.
+/// Returns the bytes consumed; a trailing partial line is left for the caller to keep.
+template <typename F>
+size_t for_each_irc_line(std::string_view data, F&& f) {
+    std::string_view::size_type start = 0, end;
+    IrcMessage msg;
+    while ((end = data.find('\n', start)) != std::string_view::npos) {
+        std::string_view line = data.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (parse_irc_message(line, msg))
+            f(msg);
+        start = end + 1;
+    }
+    return start;
+}
+
+/// P10 server links send the source numeric without a leading ':' ("AB EB"). Moves such a
+/// numeric into source and the token into command; PASS, SERVER and ERROR are left alone.
+void p10_normalize(IrcMessage& msg);
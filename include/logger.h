@@ -17,22 +17,46 @@
  */
 
 #pragma once
-#include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "misc.h"
+#include "mpscqueue.h"
 
+// Default flush policy: write out at least every interval, or as soon as this many bytes are pending.
+#define DEFAULT_LOG_FLUSH_INTERVAL 1000
+#define DEFAULT_LOG_FLUSH_BYTES 65536
+
+/// Asynchronous logger. log() only formats the line and pushes it onto a lock-free queue;
+/// a writer thread appends pending lines to the file in batches with a single write().
+/// close() (and the destructor) flush everything still queued.
 class Logger {
-    std::ofstream logfile;
+    MPSCQueue<std::string> queue;
+    std::atomic<size_t> pending_bytes{0};
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::thread writer;
+    int fd = -1;
+    unsigned int flush_interval_ms = DEFAULT_LOG_FLUSH_INTERVAL;
+    size_t flush_bytes = DEFAULT_LOG_FLUSH_BYTES;
+    TimestampPrecision precision = TimestampPrecision::Seconds;
+
+    void writerLoop();
+    void writeBatch(const std::string& batch);
+
 public:
     Logger() = default;
-    ~Logger() { if (logfile.is_open()) logfile.close(); }
-
-    void open(const std::string& filename) { logfile.open(filename, std::ios::app); }
-    void close() {
-        if (logfile.is_open()) logfile.close();
-    }
-    void log(const std::string& line) {
-        if (logfile.is_open()) logfile << "[" << get_timestamp() << "] " << line << std::endl;
-    }
-};
\ No newline at end of file
+    ~Logger() { close(); }
+
+    // Must be called before open().
+    void setFlushPolicy(unsigned int interval_ms, size_t batch_bytes);
+    void setTimestampPrecision(TimestampPrecision p) { precision = p; }
+    void open(const std::string& filename);
+    void close();
+    void log(const std::string& line);
+};
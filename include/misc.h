@@ -19,10 +19,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
-#define MAX_LOG_LINES 1000
-
 using Params = std::vector<std::string>;
 Params Tokenizer(const std::string&);
 
@@ -39,7 +38,16 @@ struct HostConfig {
 
 bool parse_host(const std::string& host, unsigned int default_port, HostConfig& out);
 
-std::string get_timestamp();
+// "HH:MM:SS" plus an optional ".mmm" or ".uuuuuu" fraction and the terminating NUL.
+#define TIMESTAMP_BUFFER_SIZE 16
+
+enum class TimestampPrecision { Seconds, Millis, Micros };
+
+// Writes the local wall-clock time into buf (NUL-terminated) and returns its length.
+// The HH:MM:SS part is cached per thread and only reformatted when the second changes.
+size_t format_timestamp(char* buf, size_t size, TimestampPrecision precision = TimestampPrecision::Seconds);
+std::string get_timestamp(TimestampPrecision precision = TimestampPrecision::Seconds);
+bool parse_timestamp_precision(const std::string& value, TimestampPrecision& out);
 std::string get_unix_username();
 std::string generate_random_number_string(size_t);
 std::string sha1_base64(const std::string& input);
@@ -50,6 +58,25 @@ int utf8_display_width(const std::string& text);
 // IRCv3 message-tags: strip "@tag=value;... " prefix so legacy parsers see normal IRC lines.
 void strip_ircv3_message_tags(std::string& line);
 
+// RFC 1459 case mapping: []\~ are the upper case forms of {}|^.
+inline char irc_fold(char c) {
+    return (c >= 'A' && c <= '^') ? static_cast<char>(c + 32) : c;
+}
+// FNV-1a over the case-folded name.
+size_t irc_hash(std::string_view s);
+bool irc_equal(std::string_view a, std::string_view b);
+
+// Case-insensitive hash and equality for containers keyed by nicks and channels.
+// Both are transparent, so lookups can take a std::string_view without building a key.
+struct NoCaseHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const { return irc_hash(text); }
+};
+struct NoCaseEqual {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const { return irc_equal(a, b); }
+};
+
 // ANSI escape codes for colors
 const std::string BLUE = "\033[34m";
 const std::string RED = "\033[31m";
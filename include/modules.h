@@ -21,6 +21,7 @@
 #include <string>
 
 #include "connection.h"
+#include "ircmessage.h"
 #include "UIManager.h"
 
 class ConnectionManager;
@@ -29,6 +30,9 @@ class Modules {
 public:
     ConnectionManager* conn = nullptr;
     UIManager& ui;
+    // Set before Attach() to replay a capture file instead of connecting.
+    std::string replayFile;
+    bool replayPaced = false;
 
     Modules(const std::string&, UIManager& _ui) : ui(_ui) {};
     virtual ~Modules() = default;
@@ -37,7 +41,14 @@ public:
     virtual void Attach() = 0;
     virtual void Detach() = 0;
     virtual void OnCommand(std::string) = 0;
-    /// display_line is the exact wire text (including IRCv3 @tags) for logs/UI; parsed_line has tags stripped for matching.
-    virtual bool Parse(const std::string& display_line, const std::string& parsed_line) = 0;
+    /// msg views the connection's receive buffer and is only valid for the duration of the call.
+    /// msg.raw is the exact wire text (including IRCv3 @tags) for logs/UI.
+    virtual bool Parse(const IrcMessage& msg) = 0;
+    /// What a connection calls for each line. Modules that run several connections override it
+    /// to tell them apart.
+    virtual bool Receive(ConnectionManager*, const IrcMessage& msg) { return Parse(msg); }
     virtual void Banner() const = 0;
+    /// Runs on the connection thread once per loop iteration, before queued data is written.
+    /// Returns the milliseconds until it wants to run again, or -1 to wait for I/O only.
+    virtual int OnTimer() { return -1; }
 };
@@ -0,0 +1,75 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/// Hands out client numerics in [0, capacity) in O(1). Fresh numerics come from a high-water
+/// mark; freed ones go through a FIFO ring, so a numeric released by QUIT or KILL is reissued
+/// as late as possible, after any messages still in flight for its previous owner.
+class NumericAllocator {
+public:
+    explicit NumericAllocator(unsigned int capacity = 0) { Reset(capacity); }
+
+    void Reset(unsigned int capacity) {
+        cap = capacity;
+        next = head = count = 0;
+        ring.assign(capacity, 0);
+        used.assign(capacity, false);
+    }
+
+    bool Alloc(unsigned int& out) {
+        if (count > 0) {
+            out = ring[head];
+            head = (head + 1) % cap;
+            count--;
+        } else if (next < cap) {
+            out = next++;
+        } else {
+            return false;
+        }
+        used[out] = true;
+        return true;
+    }
+
+    // Freeing a numeric that is not allocated is ignored.
+    void Free(unsigned int n) {
+        if (n >= cap || !used[n])
+            return;
+        used[n] = false;
+        ring[(head + count) % cap] = n;
+        count++;
+    }
+
+    bool InUse(unsigned int n) const { return n < cap && used[n]; }
+    unsigned int Capacity() const { return cap; }
+    // Every numeric in use is below this.
+    unsigned int Limit() const { return next; }
+    unsigned int Available() const { return cap - next + count; }
+    unsigned int InUseCount() const { return next - count; }
+
+private:
+    std::vector<uint32_t> ring;   // Freed numerics, oldest at head.
+    std::vector<bool> used;
+    unsigned int cap = 0;
+    unsigned int next = 0;        // Lowest numeric never handed out.
+    unsigned int head = 0;
+    unsigned int count = 0;
+};
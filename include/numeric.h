@@ -29,7 +29,7 @@ static const char convert2y[] = {
   'w','x','y','z','0','1','2','3','4','5','6','7','8','9','[',']'
 };
 
-const char* inttobase64( char* buf, unsigned int v, size_t count )
+inline const char* inttobase64( char* buf, unsigned int v, size_t count )
 {
 buf[count] = '\0';
 while (count > 0)
@@ -39,4 +39,22 @@ while (count > 0)
 	}
 
 return buf;
+}
+
+/* Inverse of convert2y, built at compile time; characters outside the alphabet decode as 0. */
+struct Base64Table {
+	unsigned char value[256];
+	constexpr Base64Table() : value() {
+		for (unsigned int i = 0; i < sizeof(convert2y); ++i)
+			value[static_cast<unsigned char>(convert2y[i])] = static_cast<unsigned char>(i);
+	}
+};
+static constexpr Base64Table convert2n;
+
+inline unsigned int base64toint( const char* s, size_t count )
+{
+unsigned int i = 0;
+while (count-- > 0)
+	i = (i << NUMNICKLOG) + convert2n.value[static_cast<unsigned char>(*s++)];
+return i;
 }
\ No newline at end of file
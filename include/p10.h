@@ -0,0 +1,165 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ircmessage.h"
+
+// Server numerics are two base64 digits, client numerics three more (YYXXX).
+#define P10_MAX_SERVERS 4096
+#define P10_CLIENT_BITS 18
+#define P10_USER_CHUNK 4096
+
+// Membership entries pack the user slot with these flag bits.
+#define P10_MEMBER_OP 0x1
+#define P10_MEMBER_VOICE 0x2
+#define P10_MEMBER_FLAGS 2
+
+// Longest P10 line, not counting its CRLF.
+#define P10_MAX_LINE 510
+
+struct P10Server {
+    bool used = false;
+    std::string name;
+    unsigned int uplink = 0;              // Numeric of the server it is linked behind.
+    unsigned int mask = 0;                // Client numeric capacity - 1, from YYMMM.
+    std::vector<uint32_t> clients;        // XXX & mask -> user slot + 1; 0 is free.
+    uint32_t userCount = 0;
+};
+
+struct P10User {
+    bool used = false;
+    uint32_t numeric = 0;                 // server << P10_CLIENT_BITS | client.
+    std::string nick;
+    std::string user;
+    std::string host;
+    std::string ip;                       // Base64 as sent on the wire.
+    std::string realname;
+    std::string account;
+    uint64_t modes = 0;                   // One bit per mode letter, see mode_bit().
+    time_t ts = 0;
+    std::vector<uint32_t> channels;       // Channel slots.
+};
+
+struct P10Channel {
+    bool used = false;
+    std::string name;
+    time_t ts = 0;
+    uint64_t modes = 0;
+    std::string key;
+    unsigned int limit = 0;
+    std::vector<uint32_t> members;        // user slot << P10_MEMBER_FLAGS | P10_MEMBER_* bits.
+    std::vector<std::string> bans;
+};
+
+/// Appends the B lines that burst a channel, each CRLF terminated and packed greedily up to
+/// P10_MAX_LINE bytes. members hold full numerics (YY << P10_CLIENT_BITS | XXX) shifted left by
+/// P10_MEMBER_FLAGS, ORed with P10_MEMBER_* bits; like ircu they are sent plain, voiced, opped, then
+/// opped and voiced, so each run needs its ":v"/":o"/":ov" suffix once per line. modes ("+ntl 50")
+/// only goes on the first line and bans fill a trailing ":%" list. Returns the number of lines.
+size_t p10_channel_burst(std::string& out, std::string_view source, std::string_view channel, time_t ts,
+                         std::string_view modes, const std::vector<uint32_t>& members,
+                         const std::vector<std::string>& bans);
+
+/// In-memory view of the P10 network behind the uplink. Servers live in a table indexed by
+/// their decoded YY numeric, each with a dense XXX -> user slot table; users and channels are
+/// pooled in vectors with free lists. Every P10 token is routed through its own handler.
+/// Dispatch() runs on the receive thread under a mutex; the Lookup*() copies may be taken from
+/// the UI thread, and the counters read from anywhere without locking.
+class P10Network {
+public:
+    P10Network();
+
+    // Applies one normalized P10 line (see p10_normalize()). Returns false for unknown tokens.
+    bool Dispatch(const IrcMessage& msg);
+
+    bool LookupUser(std::string_view nick, P10User& out) const;
+    bool LookupChannel(std::string_view name, P10Channel& out) const;
+    static std::string ModeString(uint64_t modes);
+
+    size_t ServerCount() const { return servers_linked.load(std::memory_order_relaxed); }
+    size_t UserCount() const { return users_online.load(std::memory_order_relaxed); }
+    size_t ChannelCount() const { return channels_live.load(std::memory_order_relaxed); }
+    size_t MembershipCount() const { return memberships.load(std::memory_order_relaxed); }
+    uint64_t LinesApplied() const { return lines_applied.load(std::memory_order_relaxed); }
+
+private:
+    using Handler = void (P10Network::*)(const IrcMessage&);
+    static const std::unordered_map<std::string_view, Handler> handlers;
+
+    void handle_server(const IrcMessage& msg);
+    void handle_nick(const IrcMessage& msg);
+    void handle_burst(const IrcMessage& msg);
+    void handle_join(const IrcMessage& msg);
+    void handle_create(const IrcMessage& msg);
+    void handle_part(const IrcMessage& msg);
+    void handle_kick(const IrcMessage& msg);
+    void handle_quit(const IrcMessage& msg);
+    void handle_kill(const IrcMessage& msg);
+    void handle_squit(const IrcMessage& msg);
+    void handle_mode(const IrcMessage& msg);
+    void handle_account(const IrcMessage& msg);
+
+    P10User& UserAt(uint32_t slot) { return user_chunks[slot / P10_USER_CHUNK][slot % P10_USER_CHUNK]; }
+    const P10User& UserAt(uint32_t slot) const { return user_chunks[slot / P10_USER_CHUNK][slot % P10_USER_CHUNK]; }
+    uint32_t UserSlot(std::string_view numeric) const;    // Slot + 1, 0 if unknown.
+    uint32_t ChannelSlot(std::string_view name) const;    // Slot + 1, 0 if unknown.
+    uint32_t NickSlot(std::string_view nick) const;       // Slot + 1, 0 if unknown.
+    void NickInsert(uint32_t slot);
+    void NickErase(uint32_t slot);
+    void NickGrow();
+    uint32_t AddUser(unsigned int server, unsigned int client);
+    void RemoveUser(uint32_t slot);
+    void RemoveServer(unsigned int numeric);
+    uint32_t GetChannel(std::string_view name, time_t ts);
+    void AddMember(uint32_t chan, uint32_t user, uint32_t flags);
+    void RemoveMember(uint32_t chan, uint32_t user);
+    void SetMemberFlags(uint32_t chan, uint32_t user, uint32_t flags, bool add);
+    size_t ApplyChannelModes(uint32_t chan, const IrcMessage& msg, size_t first);
+
+    mutable std::mutex mutex;
+    std::vector<P10Server> servers;
+    // Users are pooled in fixed chunks so growing the pool never moves existing entries.
+    std::vector<std::unique_ptr<P10User[]>> user_chunks;
+    uint32_t users_allocated = 0;
+    std::vector<uint32_t> free_users;
+    std::vector<P10Channel> channels;
+    std::vector<uint32_t> free_channels;
+    // Nick index: open addressing with linear probing over user slot + 1 (0 = empty). Keys are the
+    // users' own nick strings, so inserting a user allocates nothing beyond occasional growth.
+    std::vector<uint32_t> nick_table;
+    size_t nick_count = 0;
+    std::unordered_map<std::string, uint32_t> channel_names;  // Lowercased name -> channel slot.
+    std::unordered_map<std::string, unsigned int> server_names;
+
+    std::atomic<size_t> servers_linked{0};
+    std::atomic<size_t> users_online{0};
+    std::atomic<size_t> channels_live{0};
+    std::atomic<size_t> memberships{0};
+    std::atomic<uint64_t> lines_applied{0};
+};
@@ -0,0 +1,66 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/// Fenwick tree over the number of screen rows each scrollback line wraps to.
+/// Gives the total row count in O(1) and maps a row back to its line in O(log n).
+class RowIndex {
+public:
+    // Resets to n zero elements.
+    void Assign(size_t n) { tree.assign(n + 1, 0); total = 0; }
+    size_t Size() const { return tree.size() - 1; }
+    long Total() const { return total; }
+
+    // Adds delta to element i (0-based).
+    void Add(size_t i, int delta) {
+        for (++i; i < tree.size(); i += i & (~i + 1))
+            tree[i] += delta;
+        total += delta;
+    }
+
+    // Sum of the first n elements.
+    long Prefix(size_t n) const {
+        long sum = 0;
+        for (; n > 0; n -= n & (~n + 1))
+            sum += tree[n];
+        return sum;
+    }
+
+    // Index of the element containing row (0-based), i.e. the i with Prefix(i) <= row < Prefix(i + 1).
+    size_t Find(long row) const {
+        size_t pos = 0;
+        size_t step = 1;
+        while (step * 2 <= Size())
+            step *= 2;
+        for (; step > 0; step /= 2) {
+            if (pos + step <= Size() && tree[pos + step] <= row) {
+                pos += step;
+                row -= tree[pos];
+            }
+        }
+        return pos;
+    }
+
+private:
+    std::vector<long> tree = std::vector<long>(1, 0);  // 1-based.
+    long total = 0;
+};
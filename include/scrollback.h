@@ -0,0 +1,83 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "rowindex.h"
+
+// Default number of scrollback lines (the "scrollback" config key).
+#define DEFAULT_SCROLLBACK_LINES 1000
+// Text arena bytes reserved per scrollback line; longer lines simply evict more old ones.
+#define SCROLLBACK_BYTES_PER_LINE 160
+// Lines a new scrollback has room for before it first grows.
+#define SCROLLBACK_INITIAL_LINES 64
+
+/// Bounded ring of scrollback lines. Line text lives in a circular byte arena sized with the
+/// ring. Both start small and double as lines arrive, up to the capacity, so a quiet buffer stays
+/// cheap; after that appending is O(1) and never allocates, and the oldest lines are evicted when
+/// either the ring or the arena runs out of room. Also tracks how many screen rows each line
+/// wraps to, indexed by a RowIndex over the ring slots.
+class Scrollback {
+public:
+    explicit Scrollback(size_t lines = DEFAULT_SCROLLBACK_LINES);
+
+    // Changes the capacity, keeping the newest lines.
+    void Resize(size_t lines);
+    void Append(std::string_view text, int color);
+
+    size_t Size() const { return count; }
+    size_t Capacity() const { return max_lines; }
+
+    // Line i, where 0 is the oldest.
+    std::string_view Text(size_t i) const;
+    int Color(size_t i) const { return entries[Slot(i)].color; }
+
+    void SetWrapWidth(int width);
+    int WrapWidth() const { return wrap_width; }
+    long TotalRows() const { return rows.Total(); }
+    // Line containing screen row `row` (0 is the oldest row); offset receives the row within that line.
+    size_t FindRow(long row, long& offset) const;
+
+    static int RowCount(size_t length, int width);
+
+private:
+    struct Entry {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+        int color = 0;
+        int rows = 0;
+    };
+
+    size_t Slot(size_t i) const { return (first + i) % entries.size(); }
+    void EvictOldest();
+    // Doubles the ring and arena (up to the capacity), moving the live lines to the front.
+    void Grow();
+
+    size_t max_lines;
+    std::vector<Entry> entries;
+    std::vector<char> arena;
+    size_t first = 0;        // Slot of the oldest line.
+    size_t count = 0;
+    size_t arena_tail = 0;   // Where the next line's text goes.
+    RowIndex rows;           // Indexed by slot.
+    int wrap_width = 0;
+};
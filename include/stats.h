@@ -0,0 +1,117 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Log-linear buckets: values below 2^HISTOGRAM_SUB_BITS ns are exact, and every power of two above
+// is split into 2^HISTOGRAM_SUB_BITS buckets (at most 6% error). Values of 2^HISTOGRAM_MAX_BITS ns
+// (about 18 minutes) and up land in the last bucket.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 40
+// Default for the "stats_interval" config key, in seconds.
+#define DEFAULT_STATS_INTERVAL 10
+
+inline uint64_t stats_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Adds to a counter that only one thread writes: a plain load and store, no locked instruction.
+inline void stats_add(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/// HDR-style histogram of durations in nanoseconds. Record() must only be called from one
+/// thread; Summarize() may run on any other thread at the same time.
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count = 0;
+        double mean = 0;
+        uint64_t p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+    };
+
+    void Record(uint64_t ns) {
+        stats_add(counts[BucketOf(ns)]);
+        stats_add(count);
+        stats_add(sum, ns);
+        if (ns > max.load(std::memory_order_relaxed))
+            max.store(ns, std::memory_order_relaxed);
+    }
+
+    Summary Summarize() const;
+
+private:
+    static constexpr size_t SUB_BUCKETS = size_t(1) << HISTOGRAM_SUB_BITS;
+    static constexpr size_t BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * SUB_BUCKETS;
+
+    static size_t BucketOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS)
+            return ns;
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= HISTOGRAM_MAX_BITS)
+            return BUCKETS - 1;
+        int shift = msb - HISTOGRAM_SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((ns >> shift) & (SUB_BUCKETS - 1));
+    }
+    // Midpoint of the range a bucket covers.
+    static uint64_t ValueOf(size_t bucket);
+
+    std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+enum StatsStage {
+    STAGE_READ_TO_PARSE,   // Read returned -> line handed to Modules::Parse().
+    STAGE_PARSE_TO_PRINT,  // Time spent in Modules::Parse(), which ends in ui.print.
+    STAGE_SEND_TO_WRITE,   // SendData()/SendRaw() enqueue -> fully written to the socket.
+    STAGE_TLS_READ,        // SSL_read() calls that returned data, decryption included.
+    STAGE_WS_DECODE,       // WebSocket frame decoding and inflate, per message.
+    STAGE_COUNT
+};
+
+/// Always-on connection instrumentation. The connection thread records everything except
+/// send_queue, which SendData() and SendRaw() raise from any thread.
+struct ConnStats {
+    LatencyHistogram stage[STAGE_COUNT];
+
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> lines_in{0};
+    std::atomic<uint64_t> entries_out{0};   // Write buffer entries fully sent; SendRaw() batches count once.
+    std::atomic<uint64_t> read_calls{0};
+    std::atomic<uint64_t> write_calls{0};
+    std::atomic<uint64_t> poll_calls{0};
+    std::atomic<int64_t> send_queue{0};     // Entries pushed and not yet drained by the connection thread.
+    std::atomic<uint64_t> send_queue_max{0};
+    std::atomic<uint64_t> write_queue{0};   // Write buffer entries after the last flush.
+    std::atomic<uint64_t> recv_buffered{0}; // Bytes left in the receive buffer after the last read.
+
+    // Human-readable report, one line per entry, for /stats and the periodic dump.
+    void Format(std::vector<std::string>& out) const;
+};
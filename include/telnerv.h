@@ -18,8 +18,38 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 #include "modules.h"
 #include "misc.h"
+#include "p10.h"
+#include "numalloc.h"
+#include "timerwheel.h"
+#include "wsdeflate.h"
+
+// Client numerics are three base64 digits (YYXXX).
+#define MAX_SERVER_CLIENTS 262144
+// Default /traffic timer wheel tick in milliseconds, and how often the header bar shows the rates.
+#define DEFAULT_TRAFFIC_TICK 10
+#define TRAFFIC_REPORT_INTERVAL 1000
+
+enum TrafficEvent { TRAFFIC_PRIVMSG, TRAFFIC_JOIN, TRAFFIC_PART, TRAFFIC_NICK, TRAFFIC_MODE, TRAFFIC_EVENTS };
+
+/// A config template such as "user%d": the text around the first %d, which is replaced by a number.
+struct BurstTemplate {
+    std::string prefix;
+    std::string suffix;
+    bool numbered = false;
+
+    void assign(const std::string& pattern);
+    void append(std::string& out, unsigned int n) const;
+};
 
 class telnERV : public Modules {
 public:
@@ -29,8 +59,9 @@ public:
     void Attach() override;
     void Detach() override;
     void OnCommand(std::string) override;
-    bool Parse(const std::string& display_line, const std::string& parsed_line) override;
+    bool Parse(const IrcMessage& msg) override;
     void Banner() const override;
+    int OnTimer() override;
 
 private:
     Logger* logger = nullptr;
@@ -44,16 +75,80 @@ private:
     std::string caCertFile;
     std::string clientCertFile;
     std::string clientKeyFile;
+    size_t recvBufferSize;
+    WsDeflateConfig wsDeflate;
+    std::string captureFile;
+    std::string statsFile;
+    unsigned int statsInterval;
     std::string log_file;
 
     std::string serverYY;
     std::string uplinkYY;
     std::string uplinkName;
 
-    /* Ticker for bursted clients. */
-    unsigned short int clients = 0;
+    /* Mass burst (/burst and burst_clients). */
+    BurstTemplate burstNick;
+    BurstTemplate burstUser;
+    BurstTemplate burstHost;
+    std::string burstRealname;
+    std::string burstModes;
+    unsigned int burstIP;
+    unsigned int burstAtLink;
+
+    /* Set on the receive thread once the uplink's EA arrives; a burst sent before that is timed to it. */
+    std::atomic<bool> linked{false};
+    std::atomic<bool> burstTimed{false};
+    std::chrono::steady_clock::time_point burstSent;
+
+    /* State of the network behind the uplink, and timing of its burst. */
+    P10Network network;
+    std::chrono::steady_clock::time_point ingestStart;
+    uint64_t ingestLines = 0;
+
+    /* Our own clients: numerics and nicks indexed by XXX. Touched from the UI and receive threads. */
+    std::mutex clientsMutex;
+    unsigned int maxClients;
+    NumericAllocator numerics;
+    std::vector<std::string> ownNicks;
+    std::unordered_map<std::string, unsigned int, NoCaseHash, NoCaseEqual> ownNumerics;  // Nick -> XXX, for /quit.
+    unsigned int burstSerial = 0;      // Template counter; keeps generated nicks unique across reuse.
+
+    /* Synthetic traffic from our clients (/traffic). Runs on the connection thread under clientsMutex. */
+    std::atomic<bool> trafficOn{false};
+    double trafficRate;                // Events per second across all our clients.
+    bool trafficPoisson = true;        // Exponential gaps per client; otherwise fixed gaps.
+    unsigned int trafficTick;          // Milliseconds per wheel tick.
+    unsigned int trafficMix[TRAFFIC_EVENTS];
+    unsigned int trafficMixTotal = 0;
+    BurstTemplate trafficChannel;
+    std::string trafficMessage;
+    TimerWheel trafficWheel;
+    std::vector<double> trafficDue;       // Per numeric: next event, in fractional ticks.
+    std::vector<uint32_t> trafficJoined;  // Per numeric: channel index + 1, or 0.
+    std::vector<uint8_t> trafficWallops;  // Per numeric: whether +w is set.
+    std::vector<uint32_t> trafficMembers; // Per channel: how many of our clients are on it.
+    std::mt19937_64 trafficRng;
+    std::chrono::steady_clock::time_point trafficEpoch;
+    std::chrono::steady_clock::time_point trafficReported;
+    uint64_t trafficEvents = 0;        // Since trafficReported.
 
     void burstClient(std::string, std::string, std::string, std::string = "+i");
+    void massBurst(unsigned int count, const std::string& modes);
+    void channelBurst(const std::string& channel, unsigned int count, unsigned int ops, unsigned int voices,
+                      unsigned int bans, const std::string& modes);
+    void quitClient(const std::string& nick, const std::string& reason);
+    void releaseClient(unsigned int numeric);
+    void setClientNick(unsigned int numeric, std::string_view nick);
+    bool parseTrafficMix(const std::string& mix);
+    void startTraffic(double rate, bool poisson);
+    void stopTraffic();
+    void scheduleTraffic(unsigned int numeric);
+    double trafficDelay();
+    void emitTraffic(unsigned int numeric, std::string& out, const std::string& ts);
+    void appendClientLine(std::string& out, unsigned int numeric, std::string_view nick, std::string_view user,
+                          std::string_view host, std::string_view modes, unsigned int ip, std::string_view ts,
+                          std::string_view realname);
     void show_help() const;
+    void show_network(const std::string& target) const;
 
 };
@@ -18,8 +18,21 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "config.h"
 #include "modules.h"
+#include "eventloop.h"
 #include "misc.h"
+#include "wsdeflate.h"
+#include "ircmessage.h"
+
+// Query buffers opened by incoming private messages before further senders go to status.
+#define DEFAULT_MAX_QUERIES 50
 
 class telnIRC : public Modules {
 public:
@@ -29,26 +42,95 @@ public:
     void Attach() override;
     void Detach() override;
     void OnCommand(std::string) override;
-    bool Parse(const std::string& display_line, const std::string& parsed_line) override;
+    // Lines without a connection (e.g. from the benchmark) are treated as the first network's.
+    bool Parse(const IrcMessage& msg) override;
+    bool Receive(ConnectionManager* from, const IrcMessage& msg) override;
     void Banner() const override;
 
 private:
+    /// One server connection, configured in its own [telnIRC:<name>] section.
+    struct Network {
+        std::string name;
+        std::string label;          // "[name] " when there are several networks, else empty.
+        HostConfig host;
+        std::string password;
+        std::string nickname;
+        std::string username;
+        bool use_cap;
+        bool use_tls;
+        std::string caCertFile;
+        std::string clientCertFile;
+        std::string clientKeyFile;
+        size_t recvBufferSize;
+        WsDeflateConfig wsDeflate;
+        std::string captureFile;
+        std::string statsFile;
+        unsigned int statsInterval;
+        ConnectionManager* conn = nullptr;
+        // Channel or nick -> UI buffer id, looked up for every received line.
+        std::unordered_map<std::string, size_t, NoCaseHash, NoCaseEqual> buffers;
+    };
+
+    /// What a UI buffer talks to. Indexed by buffer id; the status buffer has no network.
+    struct Window {
+        Network* net = nullptr;
+        std::string target;
+        bool query = false;
+    };
+
     /* Configuration variables. */
-    HostConfig host;
-    std::string password;
-    std::string nickname;
-    std::string username;
     std::string log_file;
-    bool use_cap;
-    bool use_tls;
-    std::string caCertFile;
-    std::string clientCertFile;
-    std::string clientKeyFile;
+    size_t maxQueries;
+    unsigned int logFlushInterval;
+    size_t logFlushBytes;
+    TimestampPrecision logTimestampPrecision = TimestampPrecision::Seconds;
 
-    std::string currentBuffer; // Global variable to store the current buffer
+    std::vector<std::unique_ptr<Network>> networks;
+    std::unordered_map<ConnectionManager*, Network*> byConnection;
+    std::unique_ptr<EventLoop> loop;  // One I/O thread for every network.
+
+    // Plain input goes to the active UI buffer's target. Buffers are opened from both threads.
+    std::mutex bufferMutex;
+    std::vector<Window> windows;
+    size_t queryCount = 0;
+    Network* currentNetwork = nullptr;  // The network of the last buffer shown, used from the status buffer.
     Logger* logger = nullptr;
 
-    void handle_privmsg(const std::string& display_line, const std::string& parsed_line);
+    void loadNetwork(Network& net, const ConfigParser& config);
+    Network* findNetwork(std::string_view name);
+    // Splits an optional "network/" prefix off a target; falls back to the current network.
+    Network* resolveTarget(std::string& target);
+    // The active buffer's network and target; the target is empty in the status buffer.
+    Network* activeWindow(std::string& target);
+    // Id of the buffer for a channel or nick, opened if 'create' is set, else the status buffer.
+    size_t bufferFor(Network& net, std::string_view target, bool create);
+    // Like bufferFor(), but a new query is only opened while fewer than maxQueries are.
+    size_t queryBuffer(Network& net, std::string_view nick);
+    size_t openWindowLocked(Network& net, std::string_view target);
+    void closeWindow(size_t id);
+    // Picks the buffer a received line is printed in.
+    size_t route(Network& net, const IrcMessage& msg);
+    // Switches to the target's buffer and prints 'what' and its name when it changes, or always.
+    void setCurrentBuffer(Network& net, const std::string& target, const char* what, bool always = false);
+    std::string qualified(const Network& net, const std::string& target) const;
+    void sendRegistration(Network& net);
+    bool send(Network& net, const std::string& line);
+    void show_networks();
+
+    /* Command handlers, looked up by IRC command in Parse(). */
+    using Handler = bool (telnIRC::*)(Network&, const IrcMessage&);
+    static const std::unordered_map<std::string_view, Handler> handlers;
+
+    bool parse(Network& net, const IrcMessage& msg);
+    bool handle_welcome(Network& net, const IrcMessage& msg);
+    bool handle_nick_in_use(Network& net, const IrcMessage& msg);
+    bool handle_ping(Network& net, const IrcMessage& msg);
+    bool handle_join(Network& net, const IrcMessage& msg);
+    bool handle_nick(Network& net, const IrcMessage& msg);
+    bool handle_part(Network& net, const IrcMessage& msg);
+    bool handle_cap(Network& net, const IrcMessage& msg);
+
+    void handle_privmsg(Network& net, const IrcMessage& msg, size_t buffer);
     void show_help();
 
 };
@@ -0,0 +1,137 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+// Farthest a timer can be scheduled ahead, in ticks (64^4).
+#define TIMER_WHEEL_SPAN (uint64_t(1) << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+
+/// Hierarchical timer wheel for at most one pending timer per id in [0, capacity).
+/// Level 0 holds timers due within 64 ticks, one slot per tick; each higher level covers 64 times
+/// the span of the one below and is cascaded down whenever the level below wraps. Scheduling and
+/// cancelling are O(1) and allocation free: slots are circular lists threaded through per-id arrays.
+class TimerWheel {
+public:
+    explicit TimerWheel(unsigned int capacity = 0) { Reset(capacity, 0); }
+
+    void Reset(unsigned int capacity, uint64_t tick) {
+        ids = capacity;
+        now = tick;
+        pending = 0;
+        size_t nodes = static_cast<size_t>(capacity) + TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS;
+        next.assign(nodes, NIL);
+        prev.assign(nodes, NIL);
+        expiry.assign(capacity, 0);
+        for (uint32_t s = capacity; s < nodes; ++s)
+            next[s] = prev[s] = s;
+    }
+
+    // Schedules id to fire at the given tick; ticks already past fire on the next Advance().
+    void Schedule(unsigned int id, uint64_t tick) {
+        if (id >= ids)
+            return;
+        Cancel(id);
+        if (tick <= now)
+            tick = now + 1;
+        if (tick - now >= TIMER_WHEEL_SPAN)
+            tick = now + TIMER_WHEEL_SPAN - 1;
+        expiry[id] = tick;
+        Insert(id);
+        pending++;
+    }
+
+    void Cancel(unsigned int id) {
+        if (id >= ids || next[id] == NIL)
+            return;
+        next[prev[id]] = next[id];
+        prev[next[id]] = prev[id];
+        next[id] = prev[id] = NIL;
+        pending--;
+    }
+
+    // Moves time forward to tick, calling fire(id) for every timer that comes due, in tick order.
+    // fire() may schedule or cancel timers, including the one being fired.
+    template <typename Fn>
+    void Advance(uint64_t tick, Fn&& fire) {
+        while (now < tick) {
+            now++;
+            // Cascade each level whose lower neighbour just wrapped.
+            for (unsigned int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+                if ((now & ((uint64_t(1) << (level * TIMER_WHEEL_BITS)) - 1)) != 0)
+                    break;
+                uint32_t head = Head(level, (now >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK);
+                uint32_t id;
+                while ((id = next[head]) != head) {
+                    Unlink(id);
+                    Insert(id);
+                }
+            }
+            uint32_t head = Head(0, now & TIMER_WHEEL_MASK);
+            uint32_t id;
+            while ((id = next[head]) != head) {
+                Unlink(id);
+                pending--;
+                fire(id);
+            }
+        }
+    }
+
+    bool Scheduled(unsigned int id) const { return id < ids && next[id] != NIL; }
+    uint64_t Now() const { return now; }
+    size_t Pending() const { return pending; }
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    uint32_t Head(unsigned int level, uint64_t slot) const {
+        return ids + level * TIMER_WHEEL_SLOTS + static_cast<uint32_t>(slot);
+    }
+
+    void Unlink(uint32_t id) {
+        next[prev[id]] = next[id];
+        prev[next[id]] = prev[id];
+        next[id] = prev[id] = NIL;
+    }
+
+    void Insert(uint32_t id) {
+        uint64_t delta = expiry[id] - now;
+        unsigned int level = 0;
+        while (level + 1 < TIMER_WHEEL_LEVELS && delta >= (uint64_t(1) << ((level + 1) * TIMER_WHEEL_BITS)))
+            level++;
+        uint32_t head = Head(level, (expiry[id] >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK);
+        next[id] = head;
+        prev[id] = prev[head];
+        next[prev[head]] = id;
+        prev[head] = id;
+    }
+
+    std::vector<uint32_t> next;     // Per id, then one sentinel per slot.
+    std::vector<uint32_t> prev;
+    std::vector<uint64_t> expiry;
+    unsigned int ids = 0;
+    uint64_t now = 0;
+    size_t pending = 0;
+};
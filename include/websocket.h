@@ -0,0 +1,95 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// WebSocket opcodes (RFC 6455 section 5.2).
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+// Largest reassembled message accepted; anything bigger fails the connection.
+#define WS_MAX_MESSAGE (1024 * 1024)
+
+// Masking keys drawn from the CSPRNG per RAND_bytes() call.
+#define WS_MASK_POOL_KEYS 64
+
+/// Hands out client masking keys from a pool refilled with RAND_bytes(), so each frame
+/// costs a copy instead of seeding a generator. One instance per connection.
+class WsMaskSource {
+public:
+    void Next(unsigned char key[4]);
+
+private:
+    unsigned char pool[WS_MASK_POOL_KEYS * 4];
+    size_t pos = sizeof(pool);
+};
+
+/// Incremental frame decoder. Next() parses from a caller-owned buffer, unmasking payload
+/// in place, and stops after each complete message or control frame. A single unfragmented
+/// frame that is fully buffered is returned as a view into that buffer; fragmented messages
+/// and frames split across reads are reassembled into a buffer that is reused between messages.
+class WsDecoder {
+public:
+    enum class Event { NeedMore, Message, Ping, Pong, Close, Error };
+
+    // Decodes from data[0, len); 'consumed' is set to the bytes the caller may discard.
+    // Payload() stays valid until those bytes are discarded or Next() is called again.
+    Event Next(char* data, size_t len, size_t& consumed);
+    std::string_view Payload() const { return payload; }
+    // True if the last message had RSV1 set (permessage-deflate).
+    bool Compressed() const { return message_compressed; }
+    void AllowCompression(bool allow) { allow_compression = allow; }
+    const char* Error() const { return error; }
+
+private:
+    Event Fail(const char* reason);
+
+    // Frame currently being read.
+    bool in_frame = false;
+    bool fin = false;
+    unsigned char opcode = 0;
+    unsigned char mask[4] = { 0, 0, 0, 0 };
+    bool masked = false;
+    uint64_t remaining = 0;
+    size_t phase = 0;
+
+    bool in_message = false;     // Saw a non-final data frame; continuations follow.
+    bool allow_compression = false;
+    bool message_compressed = false;
+    std::string message;         // Reassembly buffer for fragmented or split messages.
+    std::string control;         // Control frame payload (at most 125 bytes).
+    std::string_view payload;
+    const char* error = "";
+};
+
+// XORs len bytes of in with the 4-byte key into out, eight bytes at a time. out may equal in.
+// phase is the payload offset of in[0], for masking a payload in several pieces.
+void ws_mask(char* out, const char* in, size_t len, const unsigned char key[4], size_t phase = 0);
+
+// Appends one masked client frame carrying payload to out. 'compressed' sets RSV1.
+void ws_encode_frame(std::string& out, unsigned char opcode, std::string_view payload, WsMaskSource& masks,
+                     bool compressed = false);
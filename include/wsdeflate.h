@@ -0,0 +1,78 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+// zlib cannot produce a raw deflate stream with an 8-bit window, so 9 is the smallest we offer.
+#define WS_DEFLATE_MIN_WINDOW_BITS 9
+#define WS_DEFLATE_MAX_WINDOW_BITS 15
+// Shorter messages are sent uncompressed: the sync-flush overhead outweighs any saving.
+#define WS_DEFLATE_MIN_MESSAGE 32
+
+/// permessage-deflate (RFC 7692) parameters: what we offer, and later what was agreed.
+struct WsDeflateConfig {
+    bool enabled = false;
+    bool client_no_context_takeover = false;
+    bool server_no_context_takeover = false;
+    int client_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+    int server_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+};
+
+// Sec-WebSocket-Extensions value for the handshake request.
+std::string ws_deflate_offer(const WsDeflateConfig& offer);
+// Parses the server's Sec-WebSocket-Extensions value. Returns false if the server answered with
+// an extension or parameter we did not offer; 'agreed.enabled' is false if it declined.
+bool ws_deflate_accept(std::string_view response, const WsDeflateConfig& offer, WsDeflateConfig& agreed);
+
+/// Per-connection permessage-deflate state: one raw deflate stream for outgoing messages
+/// and one inflate stream for incoming ones. The deflate stream is reset per message when
+/// client_no_context_takeover was agreed. Also counts bytes and thread CPU time for the final report.
+class WsDeflate {
+public:
+    struct Stats {
+        uint64_t raw_out = 0, wire_out = 0;
+        uint64_t raw_in = 0, wire_in = 0;
+        uint64_t deflate_ns = 0, inflate_ns = 0;
+    };
+
+    WsDeflate() = default;
+    ~WsDeflate();
+    WsDeflate(const WsDeflate&) = delete;
+    WsDeflate& operator=(const WsDeflate&) = delete;
+
+    bool Init(const WsDeflateConfig& agreed);
+    bool Active() const { return active; }
+    const WsDeflateConfig& Config() const { return config; }
+    const Stats& GetStats() const { return stats; }
+
+    // Replace 'out' with the compressed/decompressed message. Decompress() refuses output larger than max_size.
+    bool Compress(std::string_view in, std::string& out);
+    bool Decompress(std::string_view in, std::string& out, size_t max_size);
+
+private:
+    z_stream deflater{};
+    z_stream inflater{};
+    bool active = false;
+    WsDeflateConfig config;
+    Stats stats;
+};
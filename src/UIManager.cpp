@@ -25,6 +25,8 @@
 #include <clocale>
 #include <climits>
 #include <cwchar>
+#include <cerrno>
+#include <unistd.h>
 #include "UIManager.h"
 #include "misc.h"
 
@@ -32,7 +34,9 @@ volatile sig_atomic_t UIManager::resized = 0;
 
 UIManager::UIManager()
     : output_win(nullptr), header_win(nullptr), input_win(nullptr),
-      term_height(0), term_width(0), scroll_offset(0), print(this) {}
+      term_height(0), term_width(0), ui_thread(std::this_thread::get_id()), print(this) {
+    buffers.push_back(Buffer{"status", Scrollback(scrollback_lines)});
+}
 
 UIManager::~UIManager() {
     shutdown();
@@ -68,21 +72,58 @@ void UIManager::init() {
 
     wrefresh(output_win);
     wrefresh(input_win);
+    curses_active = true;
+}
+
+void UIManager::initHeadless(int fd) {
+    headless = true;
+    out_fd = fd;
+    out_buffer.reserve(HEADLESS_FLUSH_BYTES);
+}
+
+void UIManager::flush() {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    flushUnlocked();
+}
+
+void UIManager::flushUnlocked() {
+    size_t written = 0;
+    while (written < out_buffer.size()) {
+        ssize_t n = write(out_fd, out_buffer.data() + written, out_buffer.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;  // Nowhere to report it; drop the output rather than block.
+        written += n;
+    }
+    out_buffer.clear();
 }
 
 void UIManager::shutdown() {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (headless) {
+        flushUnlocked();
+        return;
+    }
     if (output_win) delwin(output_win);
     if (header_win) delwin(header_win);
     if (input_win) delwin(input_win);
     output_win = nullptr;
     header_win = nullptr;
     input_win = nullptr;
-    endwin();
+    if (curses_active)
+        endwin();
+    curses_active = false;
 }
 
 void UIManager::fatal(const std::string& msg) {
     print(NC_RED) << msg << std::endl;
+    if (headless) {
+        shutdown();
+        if (out_fd != STDOUT_FILENO)
+            std::cerr << msg << std::endl;
+        exit(1);
+    }
     waitForExit();
     shutdown();
     std::cerr << msg << std::endl;
@@ -90,6 +131,8 @@ void UIManager::fatal(const std::string& msg) {
 }
 
 void UIManager::waitForExit() {
+    if (headless)
+        return;
     scrollToBottom();
     print(NC_YELLOW) << "Press any key to exit..." << std::endl;
     redrawOutput();
@@ -103,6 +146,8 @@ void UIManager::waitForExit() {
 
 void UIManager::resize() {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (headless)
+        return;
     endwin();
     refresh();
     clear();
@@ -124,9 +169,7 @@ void UIManager::resize() {
 
     wrefresh(output_win);
     wrefresh(input_win);
-    werase(header_win);
-    mvwprintw(header_win, 0, 1, "%s", currentHeader.c_str());
-    wrefresh(header_win);
+    drawHeaderUnlocked();
     UIManager::resized = 0;
 }
 
@@ -138,6 +181,8 @@ void UIManager::redrawAll() {
 
 void UIManager::redrawInput(const std::string& input_line, int cursor_x) {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (headless)
+        return;
     werase(input_win);
     box(input_win, 0, 0);
     mvwaddstr(input_win, 1, 1, "> ");
@@ -147,12 +192,12 @@ void UIManager::redrawInput(const std::string& input_line, int cursor_x) {
     wrefresh(input_win);
 }
 
-std::vector<std::string> UIManager::wrap_text(const std::string& text, int max_width) {
+std::vector<std::string> UIManager::wrap_text(std::string_view text, int max_width) {
     std::vector<std::string> lines;
     size_t start = 0;
     while (start < text.size()) {
         size_t len = std::min((size_t)max_width, text.size() - start);
-        lines.push_back(text.substr(start, len));
+        lines.emplace_back(text.substr(start, len));
         start += len;
     }
     return lines;
@@ -160,84 +205,226 @@ std::vector<std::string> UIManager::wrap_text(const std::string& text, int max_w
 
 void UIManager::redrawOutput(bool force) {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (headless)
+        return;
+    if (header_dirty)
+        drawHeaderUnlocked();
     if (!force && !output_dirty)
         return;
     output_dirty = false;
 
+    // Only the active buffer is drawn; the others are not touched until switched to.
+    Scrollback& log_lines = buffers[active].lines;
     werase(output_win);
     int win_height, win_width;
     getmaxyx(output_win, win_height, win_width);
-
-    std::vector<std::pair<std::string, int>> wrapped_lines;
-    for (const auto& line : log_lines) {
-        auto parts = wrap_text(line.text, win_width);
-        for (const auto& part : parts) {
-            wrapped_lines.emplace_back(part, line.color_pair);
+    if (win_width != log_lines.WrapWidth())
+        log_lines.SetWrapWidth(win_width);
+
+    long total_lines = log_lines.TotalRows();
+    int lines_to_show = static_cast<int>(std::min<long>(win_height, total_lines));
+    long start_line = std::max<long>(0, total_lines - lines_to_show - buffers[active].scroll_offset);
+
+    // Only the lines overlapping the visible window are wrapped.
+    long skip = 0;
+    size_t idx = log_lines.FindRow(start_line, skip);
+    for (int i = 0; i < lines_to_show && idx < log_lines.Size(); ++idx, skip = 0) {
+        int color = log_lines.Color(idx);
+        auto parts = wrap_text(log_lines.Text(idx), win_width);
+        for (size_t part = skip; part < parts.size() && i < lines_to_show; ++part, ++i) {
+            if (color != 0)
+                wattron(output_win, COLOR_PAIR(color));
+            mvwaddnstr(output_win, i, 0, parts[part].c_str(), win_width - 1);
+            if (color != 0)
+                wattroff(output_win, COLOR_PAIR(color));
         }
     }
-
-    int total_lines = wrapped_lines.size();
-    int lines_to_show = std::min(win_height, total_lines);
-    int start_line = std::max(0, total_lines - lines_to_show - scroll_offset);
-
-    for (int i = 0; i < lines_to_show; ++i) {
-        int idx = start_line + i;
-        if (idx < 0 || idx >= (int)wrapped_lines.size()) continue;
-        const auto& [text, color] = wrapped_lines[idx];
-        if (color != 0)
-            wattron(output_win, COLOR_PAIR(color));
-        mvwaddnstr(output_win, i, 0, text.c_str(), win_width - 1);
-        if (color != 0)
-            wattroff(output_win, COLOR_PAIR(color));
-    }
     wrefresh(output_win);
 }
 
 void UIManager::setHeader(const std::string& header) {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    // Headless, a changed header becomes an output line of its own.
+    if (headless) {
+        if (!header.empty() && header != currentHeader)
+            pushLogLineUnlocked("-- " + header, NC_DEFAULT);
+        currentHeader = header;
+        return;
+    }
+    currentHeader = header;
+    drawHeaderUnlocked();
+}
+
+// Draws the header text followed by the buffers with unread lines, highlighted ones in red.
+void UIManager::drawHeaderUnlocked() {
+    header_dirty = false;
+    if (!header_win)
+        return;
     werase(header_win);
     const std::string prefix = "Current buffer: ";
-    if (header.rfind(prefix, 0) == 0) {
+    if (currentHeader.rfind(prefix, 0) == 0) {
         wattron(header_win, COLOR_PAIR(NC_BLUE));
         mvwaddstr(header_win, 0, 1, prefix.c_str());
         wattroff(header_win, COLOR_PAIR(NC_BLUE));
-        waddstr(header_win, header.substr(prefix.size()).c_str());
+        waddstr(header_win, currentHeader.substr(prefix.size()).c_str());
     } else {
-        mvwaddstr(header_win, 0, 1, header.c_str());
+        mvwaddstr(header_win, 0, 1, currentHeader.c_str());
+    }
+
+    bool first = true;
+    for (size_t id = 0; id < buffers.size(); ++id) {
+        const Buffer& buffer = buffers[id];
+        if (id == active || !buffer.open || buffer.unread == 0)
+            continue;
+        waddstr(header_win, first ? "  [Act: " : " ");
+        first = false;
+        std::string entry = std::to_string(id) + ":" + buffer.name + "(" + std::to_string(buffer.unread) + ")";
+        if (buffer.highlights != 0)
+            wattron(header_win, COLOR_PAIR(NC_RED));
+        waddstr(header_win, entry.c_str());
+        if (buffer.highlights != 0)
+            wattroff(header_win, COLOR_PAIR(NC_RED));
     }
+    if (!first)
+        waddstr(header_win, "]");
     wrefresh(header_win);
-    currentHeader = header;
 }
 
-void UIManager::pushLogLineUnlocked(const std::string& line, int color) {
+void UIManager::pushLogLineUnlocked(const std::string& line, int color, size_t target) {
+    if (headless) {
+        out_buffer += line;
+        out_buffer += '\n';
+        if (out_buffer.size() >= HEADLESS_FLUSH_BYTES)
+            flushUnlocked();
+        return;
+    }
+    if (target == NO_BUFFER)
+        target = std::this_thread::get_id() == ui_thread ? active : STATUS_BUFFER;
+    else if (target >= buffers.size() || !buffers[target].open)
+        target = STATUS_BUFFER;  // Closed since the line was routed.
+    Buffer& buffer = buffers[target];
+    Scrollback& log_lines = buffer.lines;
+    if (target == active) {
+        buffer.scroll_offset = 0;
+        output_dirty = true;
+    } else {
+        ++buffer.unread;
+        if (color == NC_RED)
+            ++buffer.highlights;
+        header_dirty = true;
+    }
     size_t start = 0, end;
     while ((end = line.find('\n', start)) != std::string::npos) {
         std::string clean = line.substr(start, end - start);
         clean.erase(std::remove(clean.begin(), clean.end(), '\r'), clean.end());
-        log_lines.push_back({clean, color});
+        log_lines.Append(clean, color);
         start = end + 1;
     }
     if (start < line.size()) {
         std::string clean = line.substr(start);
         clean.erase(std::remove(clean.begin(), clean.end(), '\r'), clean.end());
-        log_lines.push_back({clean, color});
+        log_lines.Append(clean, color);
+    }
+}
+
+void UIManager::setScrollback(size_t lines) {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    scrollback_lines = lines;
+    for (Buffer& buffer : buffers) {
+        if (buffer.open)
+            buffer.lines.Resize(lines);
+    }
+    output_dirty = true;
+}
+
+size_t UIManager::openBuffer(const std::string& name) {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (!free_buffers.empty()) {
+        size_t id = free_buffers.back();
+        free_buffers.pop_back();
+        buffers[id] = Buffer{name, Scrollback(scrollback_lines)};
+        return id;
+    }
+    buffers.push_back(Buffer{name, Scrollback(scrollback_lines)});
+    return buffers.size() - 1;
+}
+
+void UIManager::closeBuffer(size_t id) {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (id == STATUS_BUFFER || id >= buffers.size() || !buffers[id].open)
+        return;
+    // A one-line placeholder keeps the slot cheap until it is reused.
+    buffers[id] = Buffer{"", Scrollback(1)};
+    buffers[id].open = false;
+    free_buffers.push_back(id);
+    if (id == active)
+        switchBuffer(STATUS_BUFFER);
+    header_dirty = true;
+}
+
+void UIManager::renameBuffer(size_t id, const std::string& name) {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (id >= buffers.size() || !buffers[id].open)
+        return;
+    buffers[id].name = name;
+    if (id == active)
+        setHeader("Current buffer: " + name);
+    header_dirty = true;
+}
+
+void UIManager::switchBuffer(size_t id) {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (id >= buffers.size() || !buffers[id].open)
+        return;
+    active = id;
+    buffers[id].unread = 0;
+    buffers[id].highlights = 0;
+    output_dirty = true;
+    setHeader(id == STATUS_BUFFER ? "" : "Current buffer: " + buffers[id].name);
+}
+
+void UIManager::nextBuffer(int step) {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    long count = static_cast<long>(buffers.size());
+    long id = static_cast<long>(active);
+    // The status buffer is always open, so this stops within one lap.
+    do {
+        id = ((id + step) % count + count) % count;
+    } while (!buffers[id].open);
+    switchBuffer(static_cast<size_t>(id));
+}
+
+size_t UIManager::activeBuffer() const {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    return active;
+}
+
+void UIManager::listBuffers() {
+    std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    for (size_t id = 0; id < buffers.size(); ++id) {
+        const Buffer& buffer = buffers[id];
+        if (!buffer.open)
+            continue;
+        print(NC_YELLOW) << (id == active ? "* " : "  ") << id << ":" << buffer.name;
+        if (buffer.unread != 0)
+            print << " (" << buffer.unread << " unread, " << buffer.highlights << " highlighted)";
+        print << std::endl;
     }
-    while (log_lines.size() > MAX_LOG_LINES) log_lines.erase(log_lines.begin());
 }
 
 void UIManager::clampScroll() {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    if (headless)
+        return;
     int win_height, win_width;
     getmaxyx(output_win, win_height, win_width);
+    Scrollback& log_lines = buffers[active].lines;
+    int& scroll_offset = buffers[active].scroll_offset;
+    if (win_width != log_lines.WrapWidth())
+        log_lines.SetWrapWidth(win_width);
 
-    int wrapped_count = 0;
-    for (const auto& line : log_lines) {
-        auto parts = wrap_text(line.text, win_width);
-        wrapped_count += static_cast<int>(parts.size());
-    }
-
-    int max_scroll = std::max(0, wrapped_count - win_height);
-    if (scroll_offset > max_scroll) scroll_offset = max_scroll;
+    long max_scroll = std::max<long>(0, log_lines.TotalRows() - win_height);
+    if (scroll_offset > max_scroll) scroll_offset = static_cast<int>(max_scroll);
     if (scroll_offset < 0) scroll_offset = 0;
 }
 
@@ -266,6 +453,10 @@ int UIManager::getInput(std::string& input_line, int& cursor_x, bool& resized_fl
     if (wc == L'\n' || wc == L'\r')
         return '\n';
 
+    // Other control keys (e.g. ^N/^P to switch buffers) are returned rather than typed.
+    if (wc < 0x20)
+        return static_cast<int>(wc);
+
     char mb[MB_LEN_MAX];
     mbstate_t ps{};
     size_t n = wcrtomb(mb, static_cast<wchar_t>(wc), &ps);
@@ -277,11 +468,12 @@ int UIManager::getInput(std::string& input_line, int& cursor_x, bool& resized_fl
 
 void UIManager::scrollUp(int lines) {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
-    scroll_offset += lines;
+    buffers[active].scroll_offset += lines;
     clampScroll();
 }
 void UIManager::scrollDown(int lines) {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
+    int& scroll_offset = buffers[active].scroll_offset;
     scroll_offset -= lines;
     if (scroll_offset < 0) scroll_offset = 0;
 }
@@ -297,5 +489,5 @@ void UIManager::scrollPageDown() {
 }
 void UIManager::scrollToBottom() {
     std::lock_guard<std::recursive_mutex> lock(display_mutex);
-    scroll_offset = 0;
+    buffers[active].scroll_offset = 0;
 }
\ No newline at end of file
@@ -0,0 +1,378 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+// Microbenchmarks for the per-line hot paths, run with `make bench`.
+// Usage: telnirc-bench [-t ms] [filter]
+
+#include <atomic>
+#include <chrono>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <new>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "ircmessage.h"
+#include "misc.h"
+#include "numeric.h"
+#include "p10.h"
+#include "telnerv.h"
+#include "telnirc.h"
+#include "UIManager.h"
+#include "websocket.h"
+
+volatile sig_atomic_t stop_program = 0;
+
+// Minimum time each benchmark runs for, in milliseconds (-t).
+#define BENCH_DEFAULT_MS 300
+// Lines in each generated corpus.
+#define BENCH_CORPUS_LINES 10000
+// Bans in each generated channel burst.
+#define BENCH_BURST_BANS 100
+
+/* Every heap allocation in the process goes through these, so allocations/op is exact. */
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static unsigned int min_ms = BENCH_DEFAULT_MS;
+static const char* name_filter = nullptr;
+
+// Runs pass() (which performs ops operations) until min_ms has elapsed and prints the per-op cost.
+template <typename F>
+static void run(const char* name, size_t ops, F&& pass) {
+    if (name_filter && !strstr(name, name_filter))
+        return;
+    pass();  // Warm up caches and any lazily grown buffers.
+
+    uint64_t passes = 0;
+    uint64_t allocs = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds elapsed;
+    do {
+        pass();
+        passes++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed < std::chrono::milliseconds(min_ms));
+    allocs = allocations.load(std::memory_order_relaxed) - allocs;
+
+    double total = static_cast<double>(passes) * ops;
+    double ns = elapsed.count() / total;
+    printf("%-28s %12.1f %14.0f %12.2f\n", name, ns, 1e9 / ns, allocs / total);
+    fflush(stdout);
+}
+
+/* Corpora: deterministic, shaped like a busy client connection and a hub link. */
+
+static const char* const words[] = {
+    "the", "a", "is", "it", "to", "and", "of", "in", "that", "for", "you", "lol", "yeah", "ok", "server",
+    "channel", "netsplit", "anyone", "here", "know", "how", "configure", "ircu", "services", "please",
+    "thanks", "hello", "everyone", "what", "time", "tomorrow", "https://example.org/some/longer/path?x=1",
+    "café", "naïve", "日本語", "привет", "🙂", "über", "¿qué?", ":)", "brb", "afk", "kthx", "rehash",
+};
+
+static std::string sentence(std::mt19937& rng, unsigned int max_words) {
+    std::string text;
+    unsigned int count = 1 + rng() % max_words;
+    for (unsigned int i = 0; i < count; ++i) {
+        if (i)
+            text += ' ';
+        text += words[rng() % (sizeof(words) / sizeof(words[0]))];
+    }
+    return text;
+}
+
+static std::string source(std::mt19937& rng) {
+    unsigned int n = rng() % 500;
+    return "nick" + std::to_string(n) + "!~user" + std::to_string(n) + "@" + std::to_string(n % 97) + ".users.undernet.org";
+}
+
+static std::string tags(std::mt19937& rng) {
+    if (rng() % 2)
+        return "";
+    return "@time=2026-03-14T15:" + std::to_string(10 + rng() % 50) + ":26." + std::to_string(100 + rng() % 900)
+           + "Z;msgid=" + std::to_string(rng()) + ";account=acct" + std::to_string(rng() % 300) + " ";
+}
+
+// Server-to-client lines. Nothing here makes telnIRC::Parse() reply to the server.
+static std::vector<std::string> client_corpus() {
+    std::mt19937 rng(1);
+    std::vector<std::string> lines;
+    while (lines.size() < BENCH_CORPUS_LINES) {
+        std::string chan = "#chan" + std::to_string(rng() % 50);
+        unsigned int kind = rng() % 100;
+        if (kind < 60) {
+            lines.push_back(tags(rng) + ":" + source(rng) + " PRIVMSG " + chan + " :" + sentence(rng, 30));
+        } else if (kind < 68) {
+            lines.push_back(tags(rng) + ":" + source(rng) + " NOTICE " + chan + " :" + sentence(rng, 12));
+        } else if (kind < 76) {
+            lines.push_back(tags(rng) + ":" + source(rng) + (rng() % 2 ? " PART " + chan + " :" + sentence(rng, 4) : " JOIN " + chan));
+        } else if (kind < 82) {
+            lines.push_back(":" + source(rng) + " QUIT :" + sentence(rng, 6));
+        } else if (kind < 88) {
+            lines.push_back(":" + source(rng) + " MODE " + chan + " +o nick" + std::to_string(rng() % 500));
+        } else if (kind < 94) {
+            std::string names = ":irc.undernet.org 353 bench = " + chan + " :";
+            for (unsigned int i = 0; i < 40; ++i)
+                names += (i % 7 == 0 ? "@" : "") + std::string("nick") + std::to_string(rng() % 500) + " ";
+            lines.push_back(names);
+        } else {
+            lines.push_back(":irc.undernet.org 332 bench " + chan + " :" + sentence(rng, 20));
+        }
+    }
+    return lines;
+}
+
+// Hub-to-leaf P10 lines: cycles of clients connecting, chatting, joining and quitting, so the
+// network state stays the same size however often the corpus is replayed.
+static std::vector<std::string> server_corpus() {
+    std::mt19937 rng(2);
+    std::vector<std::string> lines;
+    const unsigned int clients = 500;
+    char numeric[4];
+    auto yyxxx = [&](unsigned int n) {
+        inttobase64(numeric, n, 3);
+        return "AB" + std::string(numeric);
+    };
+    while (lines.size() < BENCH_CORPUS_LINES) {
+        for (unsigned int n = 0; n < clients; ++n)
+            lines.push_back("AB N nick" + std::to_string(n) + " 2 1773500000 ~user" + std::to_string(n) + " "
+                            + std::to_string(n % 97) + ".users.undernet.org +iw B]AAAB " + yyxxx(n) + " :" + sentence(rng, 4));
+        std::string burst = "AB B #big 1773400000 +nt ";
+        for (unsigned int n = 0; n < 60; ++n)
+            burst += (n ? "," : "") + yyxxx(n) + (n == 50 ? ":o" : "");
+        lines.push_back(burst);
+        for (unsigned int i = 0; i < clients * 4; ++i) {
+            unsigned int n = rng() % clients;
+            std::string chan = "#chan" + std::to_string(rng() % 50);
+            switch (rng() % 5) {
+            case 0: lines.push_back(yyxxx(n) + " J " + chan + " 1773500000"); break;
+            case 1: lines.push_back(yyxxx(n) + " L " + chan + " :" + sentence(rng, 3)); break;
+            case 2: lines.push_back(yyxxx(n) + " M nick" + std::to_string(n) + " :+x"); break;
+            default: lines.push_back(yyxxx(n) + " P " + chan + " :" + sentence(rng, 30)); break;
+            }
+        }
+        for (unsigned int n = 0; n < clients; ++n)
+            lines.push_back(yyxxx(n) + " Q :" + sentence(rng, 3));
+    }
+    return lines;
+}
+
+// Unmasked server frames, one text message per line.
+static std::string server_frames(const std::vector<std::string>& lines) {
+    std::string out;
+    for (const std::string& line : lines) {
+        out += static_cast<char>(0x80 | WS_OPCODE_TEXT);
+        if (line.size() < 126) {
+            out += static_cast<char>(line.size());
+        } else {
+            out += static_cast<char>(126);
+            out += static_cast<char>(line.size() >> 8);
+            out += static_cast<char>(line.size() & 0xff);
+        }
+        out += line;
+    }
+    return out;
+}
+
+static std::vector<IrcMessage> parse_all(const std::vector<std::string>& lines, bool p10) {
+    std::vector<IrcMessage> messages(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        parse_irc_message(lines[i], messages[i]);
+        if (p10)
+            p10_normalize(messages[i]);
+    }
+    return messages;
+}
+
+static std::string write_config() {
+    char path[] = "/tmp/telnirc-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    const char config[] = "[telnIRC]\nnick=bench\n\n[telnERV]\nnumeric=1\nserver_name=bench.undernet.org\n";
+    if (write(fd, config, sizeof(config) - 1) != static_cast<ssize_t>(sizeof(config) - 1)) {
+        perror("write");
+        exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            min_ms = static_cast<unsigned int>(atoi(argv[++i]));
+        else
+            name_filter = argv[i];
+    }
+    setlocale(LC_ALL, "");
+
+    std::vector<std::string> client = client_corpus();
+    std::vector<std::string> server = server_corpus();
+    size_t n = client.size();
+    std::string stream;
+    for (const std::string& line : client)
+        stream += line + "\r\n";
+
+    // Module output is formatted as usual and written to /dev/null.
+    int devnull = open("/dev/null", O_WRONLY);
+    UIManager ui;
+    ui.initHeadless(devnull);
+    std::string config = write_config();
+    telnIRC irc(config, ui);
+    telnERV erv(config, ui);
+    unlink(config.c_str());
+
+    printf("%-28s %12s %14s %12s\n", "benchmark", "ns/op", "lines/s", "allocs/op");
+
+    run("Tokenizer", n, [&] {
+        for (const std::string& line : client) {
+            Params params = Tokenizer(line);
+            asm volatile("" : : "r"(params.data()));
+        }
+    });
+
+    std::string scratch;
+    run("strip_ircv3_message_tags", n, [&] {
+        for (const std::string& line : client) {
+            scratch.assign(line);
+            strip_ircv3_message_tags(scratch);
+        }
+    });
+
+    run("parse_irc_message", n, [&] {
+        IrcMessage msg;
+        for (const std::string& line : client)
+            parse_irc_message(line, msg);
+        asm volatile("" : : "r"(&msg) : "memory");
+    });
+
+    run("for_each_irc_line", n, [&] {
+        size_t count = 0;
+        for_each_irc_line(stream, [&](const IrcMessage&) { count++; });
+        asm volatile("" : : "r"(count));
+    });
+
+    std::vector<IrcMessage> messages = parse_all(client, false);
+    run("telnIRC::Parse", n, [&] {
+        for (const IrcMessage& msg : messages)
+            irc.Parse(msg);
+        ui.flush();
+    });
+
+    std::vector<std::string> link = { "PASS :bench", "SERVER hub.undernet.org 1 1773400000 1773400000 J10 AB]]] +h6 :hub" };
+    for (const IrcMessage& msg : parse_all(link, false))
+        erv.Parse(msg);
+    std::vector<IrcMessage> p10 = parse_all(server, false);
+    run("telnERV::Parse", p10.size(), [&] {
+        for (const IrcMessage& msg : p10)
+            erv.Parse(msg);
+        ui.flush();
+    });
+
+    WsMaskSource masks;
+    std::string frame;
+    run("ws_encode_frame", n, [&] {
+        for (const std::string& line : client) {
+            frame.clear();
+            ws_encode_frame(frame, WS_OPCODE_TEXT, line, masks);
+        }
+    });
+
+    // Channel bursts shaped like /cburst output: 5% ops, 10% voices (some both) and 100 bans.
+    // One op is one member; the packing is printed after each run.
+    std::vector<std::string> bans;
+    for (unsigned int i = 0; i < BENCH_BURST_BANS; ++i)
+        bans.push_back("*!*@ban" + std::to_string(i) + ".users.undernet.org");
+    for (uint32_t count : { 10000u, 20000u }) {
+        std::vector<uint32_t> members;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t flags = (i % 100 < 5 ? P10_MEMBER_OP : 0) | ((i * 37 + 11) % 100 < 10 ? P10_MEMBER_VOICE : 0);
+            members.push_back(((1u << P10_CLIENT_BITS | i) << P10_MEMBER_FLAGS) | flags);
+        }
+        std::string name = "p10_channel_burst/" + std::to_string(count);
+        std::string burst;
+        size_t lines = 0;
+        run(name.c_str(), count, [&] {
+            burst.clear();
+            lines = p10_channel_burst(burst, "AB", "#bench", 1773400000, "+ntl 50", members, bans);
+        });
+        if (lines > 0) {
+            size_t bytes = burst.size() - 2 * lines;
+            printf("  %u members, %zu bans: %zu B lines, %zu bytes, %.1f%% of %d-byte lines\n", count, bans.size(),
+                   lines, bytes, 100.0 * bytes / (lines * P10_MAX_LINE), P10_MAX_LINE);
+        }
+    }
+
+    std::string frames = server_frames(client);
+    run("WsDecoder::Next", n, [&] {
+        WsDecoder decoder;
+        size_t offset = 0, consumed = 0;
+        while (decoder.Next(frames.data() + offset, frames.size() - offset, consumed) == WsDecoder::Event::Message)
+            offset += consumed;
+    });
+
+    run("UIManager::wrap_text", n, [&] {
+        for (const std::string& line : client) {
+            auto rows = UIManager::wrap_text(line, 80);
+            asm volatile("" : : "r"(rows.data()));
+        }
+    });
+
+    int width = 0;
+    run("utf8_display_width", n, [&] {
+        for (const std::string& line : client)
+            width += utf8_display_width(line);
+    });
+
+    run("get_timestamp", n, [&] {
+        for (size_t i = 0; i < n; ++i) {
+            std::string ts = get_timestamp();
+            asm volatile("" : : "r"(ts.data()));
+        }
+    });
+
+    char ts[TIMESTAMP_BUFFER_SIZE];
+    run("format_timestamp", n, [&] {
+        for (size_t i = 0; i < n; ++i)
+            format_timestamp(ts, sizeof(ts));
+    });
+
+    close(devnull);
+    return width < 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+static uint64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void append_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool CaptureWriter::Open(const std::string& path) {
+    Close();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    pending.assign(CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+    last_ns = monotonic_ns();
+    bytes = 0;
+    error = 0;
+    return true;
+}
+
+void CaptureWriter::Close() {
+    if (fd < 0)
+        return;
+    Flush();
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+void CaptureWriter::Data(const char* data, size_t len) {
+    bytes += len;
+    Record(CAPTURE_DATA, data, len);
+}
+
+void CaptureWriter::WebSocket(const WsDeflateConfig& agreed) {
+    const char payload[5] = {
+        static_cast<char>(agreed.enabled),
+        static_cast<char>(agreed.client_no_context_takeover),
+        static_cast<char>(agreed.server_no_context_takeover),
+        static_cast<char>(agreed.client_max_window_bits),
+        static_cast<char>(agreed.server_max_window_bits),
+    };
+    Record(CAPTURE_WEBSOCKET, payload, sizeof(payload));
+}
+
+void CaptureWriter::Record(uint8_t type, const char* data, size_t len) {
+    if (fd < 0)
+        return;
+    uint64_t now = monotonic_ns();
+    pending += static_cast<char>(type);
+    append_varint(pending, now - last_ns);
+    append_varint(pending, len);
+    pending.append(data, len);
+    last_ns = now;
+    if (pending.size() >= CAPTURE_FLUSH_BYTES)
+        Flush();
+}
+
+void CaptureWriter::Flush() {
+    size_t done = 0;
+    while (done < pending.size()) {
+        ssize_t n = ::write(fd, pending.data() + done, pending.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            // Disk full or similar: the capture ends here rather than stalling the connection.
+            // Nothing more is appended, so a reader sees a truncated last record, not garbage.
+            error = n < 0 ? errno : EIO;
+            ::close(fd);
+            fd = -1;
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    pending.clear();
+}
+
+bool CaptureWriter::TakeError(int& err) {
+    if (error == 0)
+        return false;
+    err = error;
+    error = 0;
+    return true;
+}
+
+bool CaptureReader::Open(const std::string& path, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "Error opening " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    contents.clear();
+    char chunk[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            error = "Error reading " + path + ": " + strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        if (n == 0)
+            break;
+        contents.append(chunk, n);
+    }
+    ::close(fd);
+
+    if (contents.compare(0, CAPTURE_MAGIC_SIZE, CAPTURE_MAGIC) != 0) {
+        error = path + " is not a capture file";
+        return false;
+    }
+    pos = CAPTURE_MAGIC_SIZE;
+    time_ns = 0;
+    truncated = false;
+    return true;
+}
+
+bool CaptureReader::ReadVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= contents.size())
+            return false;
+        unsigned char byte = contents[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool CaptureReader::Next(Record& out) {
+    if (pos >= contents.size())
+        return false;
+
+    out.type = contents[pos++];
+    uint64_t delta, len;
+    if (!ReadVarint(delta) || !ReadVarint(len) || len > contents.size() - pos) {
+        truncated = true;
+        pos = contents.size();
+        return false;
+    }
+
+    time_ns += delta;
+    out.time_ns = time_ns;
+    out.data = std::string_view(contents).substr(pos, len);
+    pos += len;
+    return true;
+}
+
+bool CaptureReader::DecodeWebSocket(std::string_view data, WsDeflateConfig& agreed) {
+    if (data.size() < 5)
+        return false;
+    agreed.enabled = data[0] != 0;
+    agreed.client_no_context_takeover = data[1] != 0;
+    agreed.server_no_context_takeover = data[2] != 0;
+    agreed.client_max_window_bits = static_cast<unsigned char>(data[3]);
+    agreed.server_max_window_bits = static_cast<unsigned char>(data[4]);
+    return true;
+}
@@ -35,6 +35,7 @@ bool ConfigParser::load(const std::string& filename, const std::string& section)
 
     std::string line;
     bool in_section = false;
+    found_section = false;
 
     while (std::getline(file, line)) {
         trim(line);
@@ -45,6 +46,7 @@ bool ConfigParser::load(const std::string& filename, const std::string& section)
         // Check if it's a section
         if (line[0] == '[' && line.back() == ']') {
             in_section = (line.substr(1, line.size() - 2) == section);
+            found_section = found_section || in_section;
             continue;
         }
 
@@ -22,17 +22,20 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <chrono>
 #include <thread>
-#include <random>
 #include <sstream>
+#include <algorithm>
 
 #include "connection.h"
 #include "misc.h"
 
 ConnectionManager::ConnectionManager(Modules* _mod, UIManager& _ui, Logger* _logger, const HostConfig& _host,
-    bool useTLS, std::string _caCertFile, std::string _clientCertFile, std::string _clientKeyFile)
-    : mod(_mod), ui(_ui), logger(_logger), host(_host),
+    bool useTLS, std::string _caCertFile, std::string _clientCertFile, std::string _clientKeyFile,
+    size_t _recvBufferSize, const WsDeflateConfig& _wsDeflate, const std::string& _captureFile)
+    : mod(_mod), ui(_ui), logger(_logger), host(_host), buffer(std::max<size_t>(_recvBufferSize, MIN_RECV_BUFFER)),
+      ws_deflate_offer_config(_wsDeflate),
       tls_enabled(useTLS || host.implicit_tls), caCertFile(_caCertFile),
       clientCertFile(_clientCertFile), clientKeyFile(_clientKeyFile) {
     websocket_mode = host.transport == HostConfig::Transport::WebSocket;
@@ -71,6 +74,14 @@ ConnectionManager::ConnectionManager(Modules* _mod, UIManager& _ui, Logger* _log
         ui.fatal("Error setting socket to non-blocking mode: " + std::string(strerror(errno)));
     }
 
+    handshake_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(HANDSHAKE_TIMEOUT);
+
+    if (!_captureFile.empty()) {
+        if (!capture.Open(_captureFile))
+            ui.fatal("Error opening capture file " + _captureFile + ": " + strerror(errno));
+        ui.print(NC_YELLOW) << "Capturing received data to " << _captureFile << std::endl;
+    }
+
     ui.print(NC_YELLOW) << "Connecting to " << host.original << std::endl;
 
     if (tls_enabled) {
@@ -88,14 +99,28 @@ ConnectionManager::ConnectionManager(Modules* _mod, UIManager& _ui, Logger* _log
             ui.fatal("Error creating SSL object");
         }
         SSL_set_fd(ssl, sockfd);
+        SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
         SSL_set_tlsext_host_name(ssl, host.hostname.c_str());
     }
 }
 
+ConnectionManager::ConnectionManager(Modules* _mod, UIManager& _ui, Logger* _logger, const std::string& _replayFile,
+    bool _replayPaced, size_t _recvBufferSize)
+    : mod(_mod), ui(_ui), logger(_logger), sockfd(-1), buffer(std::max<size_t>(_recvBufferSize, MIN_RECV_BUFFER)),
+      replay_file(_replayFile), replay_paced(_replayPaced) {
+    ui.print(NC_YELLOW) << "Replaying " << replay_file << (replay_paced ? " at recorded pacing" : " as fast as possible")
+                        << std::endl;
+}
+
 ConnectionManager::~ConnectionManager() {
     Stop();
     cleanup_tls();
-    close(sockfd);
+    capture.Close();
+    report_capture_error();
+    if (stats_fd != -1)
+        close(stats_fd);
+    if (sockfd != -1)
+        close(sockfd);
 }
 
 void ConnectionManager::cleanup_tls() {
@@ -112,24 +137,177 @@ void ConnectionManager::cleanup_tls() {
 }
 
 void ConnectionManager::Start() {
-    receive_thread = std::thread([this] { MainLoop(); });
+    if (!replay_file.empty()) {
+        replay_thread = std::thread([this] { ReplayLoop(); });
+        return;
+    }
+    own_loop = std::make_unique<EventLoop>(ui);
+    own_loop->Add(this);
+    own_loop->Start();
 }
 
 void ConnectionManager::Stop() {
-    if (receive_thread.joinable()) {
-        receive_thread.join();
+    if (own_loop)
+        own_loop->Stop();
+    if (replay_thread.joinable())
+        replay_thread.join();
+}
+
+void ConnectionManager::SetName(const std::string& name) {
+    label = name.empty() ? "" : "[" + name + "] ";
+}
+
+void ConnectionManager::Wakeup() {
+    if (loop)
+        loop->Wakeup();
+}
+
+short ConnectionManager::PollEvents() const {
+    if ((tls_enabled && !tls_handshake_done) || (websocket_mode && !ws_handshake_done))
+        return handshake_events;
+    return (writeBuffer.empty() && tls_record.empty()) ? POLLIN : (POLLIN | POLLOUT);
+}
+
+// Handshakes are bounded by a deadline, and records already decrypted inside OpenSSL do not
+// show up on the socket, so don't sleep on those.
+int ConnectionManager::PollTimeout() const {
+    if ((tls_enabled && !tls_handshake_done) || (websocket_mode && !ws_handshake_done)) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            handshake_deadline - std::chrono::steady_clock::now());
+        return static_cast<int>(std::max<long long>(0, left.count()));
+    }
+    if (tls_enabled && SSL_pending(ssl) > 0)
+        return 0;
+    return timer_timeout;
+}
+
+void ConnectionManager::Process(short revents) {
+    if (tls_enabled && !tls_handshake_done && !PerformTLSHandshake())
+        return;
+    if (websocket_mode && !ws_handshake_done && !PerformWebSocketHandshake())
+        return;
+
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) || (tls_enabled && SSL_pending(ssl) > 0))
+        receive_message();
+    if (closed)
+        return;
+
+    timer_timeout = mod->OnTimer();
+    if (stats_fd != -1) {
+        int dump_timeout = DumpStatsIfDue();
+        if (timer_timeout < 0 || dump_timeout < timer_timeout)
+            timer_timeout = dump_timeout;
+    }
+    WriteBufferedData();
+    stats.write_queue.store(writeBuffer.size(), std::memory_order_relaxed);
+}
+
+void ConnectionManager::DrainSendQueue() {
+    int64_t queued = stats.send_queue.load(std::memory_order_relaxed);
+    if (queued > static_cast<int64_t>(stats.send_queue_max.load(std::memory_order_relaxed)))
+        stats.send_queue_max.store(queued, std::memory_order_relaxed);
+
+    QueuedData entry;
+    int64_t drained = 0;
+    while (sendQueue.Pop(entry)) {
+        drained++;
+        if (websocket_mode) {
+            // One frame per line; only SendRaw() entries hold more than one.
+            std::string frame;
+            std::string_view rest = entry.data;
+            while (!rest.empty()) {
+                size_t end = rest.find("\r\n");
+                std::string_view line = rest.substr(0, end);
+                rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 2);
+                if (ws_deflate.Active() && line.size() >= WS_DEFLATE_MIN_MESSAGE && ws_deflate.Compress(line, ws_scratch))
+                    ws_encode_frame(frame, WS_OPCODE_TEXT, ws_scratch, ws_masks, true);
+                else
+                    ws_encode_frame(frame, WS_OPCODE_TEXT, line, ws_masks);
+            }
+            if (!frame.empty())
+                writeBuffer.push_back({ std::move(frame), entry.queued_ns });
+        } else if (!entry.data.empty()) {
+            writeBuffer.push_back(std::move(entry));
+        }
     }
+    if (drained > 0)
+        stats.send_queue.fetch_sub(drained, std::memory_order_relaxed);
+}
+
+void ConnectionManager::capture_data(const char* data, size_t len) {
+    capture.Data(data, len);
+    report_capture_error();
+}
+
+// Reports, once, a capture that stopped because a write failed.
+void ConnectionManager::report_capture_error() {
+    int err;
+    if (capture.TakeError(err))
+        ui.print(NC_RED) << label << "Capture write failed, recording stopped: " << strerror(err) << std::endl;
 }
 
 void ConnectionManager::SendData(const std::string& data) {
+    stats.send_queue.fetch_add(1, std::memory_order_relaxed);
     if (websocket_mode)
-        writeBuffer.push_back(data);
+        sendQueue.Push({ data, stats_now_ns() });
     else
-        writeBuffer.push_back(data + "\r\n");
+        sendQueue.Push({ data + "\r\n", stats_now_ns() });
+
+    if (loop)
+        loop->Notify();
 
-    ui.print << get_timestamp() << " <- " << data << std::endl;
+    ui.print << get_timestamp() << " " << label << "<- " << data << std::endl;
     if (logger)
-        logger->log("<- " + data);
+        logger->log(label + "<- " + data);
+}
+
+void ConnectionManager::SendRaw(std::string data, size_t lines) {
+    if (lines > 1)
+        raw_extra_lines.fetch_add(lines - 1, std::memory_order_relaxed);
+    stats.send_queue.fetch_add(1, std::memory_order_relaxed);
+    sendQueue.Push({ std::move(data), stats_now_ns() });
+    // The connection thread drains the queue before it next polls, so it needs no wakeup.
+    if (loop && !loop->OnLoopThread())
+        loop->Notify();
+}
+
+size_t ConnectionManager::WriteBacklog() const {
+    size_t bytes = tls_record.size();
+    for (const auto& entry : writeBuffer)
+        bytes += entry.data.size();
+    return bytes - write_offset;
+}
+
+void ConnectionManager::SetStatsDump(const std::string& file, unsigned int interval) {
+    stats_fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (stats_fd < 0)
+        ui.fatal("Error opening stats file " + file + ": " + strerror(errno));
+    stats_interval = std::max(interval, 1u);
+    next_stats_dump = std::chrono::steady_clock::now() + std::chrono::seconds(stats_interval);
+}
+
+void ConnectionManager::ReportStats() {
+    std::vector<std::string> lines;
+    stats.Format(lines);
+    for (const auto& line : lines)
+        ui.print(NC_YELLOW) << line << std::endl;
+}
+
+// Appends a timestamped report when the interval has passed. Returns the milliseconds to the next one.
+int ConnectionManager::DumpStatsIfDue() {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_stats_dump) {
+        std::string report = "-- " + get_timestamp() + (label.empty() ? "" : " " + label) + "\n";
+        std::vector<std::string> lines;
+        stats.Format(lines);
+        for (const auto& line : lines)
+            report += line + "\n";
+        // Best effort, like the logger: a failed write only loses this report.
+        [[maybe_unused]] ssize_t ret = write(stats_fd, report.data(), report.size());
+        while (next_stats_dump <= now)
+            next_stats_dump += std::chrono::seconds(stats_interval);
+    }
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_stats_dump - now).count()) + 1;
 }
 
 ssize_t ConnectionManager::transport_write(const char* buf, size_t len) {
@@ -140,7 +318,7 @@ ssize_t ConnectionManager::transport_write(const char* buf, size_t len) {
             if (err == SSL_ERROR_WANT_WRITE)
                 return -1;
             ui.print(NC_RED) << "TLS Write Error" << std::endl;
-            stop_program = 1;
+            closed = true;
             return -1;
         }
         return bytesSent;
@@ -150,7 +328,19 @@ ssize_t ConnectionManager::transport_write(const char* buf, size_t len) {
         if (errno == EWOULDBLOCK || errno == EAGAIN)
             return -1;
         ui.print(NC_RED) << "Error sending message" << std::endl;
-        stop_program = 1;
+        closed = true;
+        return -1;
+    }
+    return bytesSent;
+}
+
+ssize_t ConnectionManager::transport_writev(const struct iovec* iov, int count) {
+    ssize_t bytesSent = writev(sockfd, iov, count);
+    if (bytesSent < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN)
+            return -1;
+        ui.print(NC_RED) << "Error sending message" << std::endl;
+        closed = true;
         return -1;
     }
     return bytesSent;
@@ -164,7 +354,7 @@ ssize_t ConnectionManager::transport_read(char* buf, size_t len) {
             if (err == SSL_ERROR_WANT_READ)
                 return -1;
             ui.print(NC_RED) << "TLS Read Error" << std::endl;
-            stop_program = 1;
+            closed = true;
             return -1;
         }
         return bytes_received;
@@ -174,145 +364,184 @@ ssize_t ConnectionManager::transport_read(char* buf, size_t len) {
         if (errno == EWOULDBLOCK || errno == EAGAIN)
             return -1;
         ui.print(NC_RED) << "Error receiving message" << std::endl;
-        close(sockfd);
-        stop_program = 1;
+        closed = true;
         return -1;
     }
     return bytes_received;
 }
 
-std::string ConnectionManager::encode_websocket_frame(const std::string& payload) {
-    std::string frame;
-    frame.reserve(payload.size() + 14);
-    frame.push_back(static_cast<char>(0x81)); // FIN + text frame
-
-    size_t len = payload.size();
-    unsigned char mask_bit = 0x80;
-
-    if (len < 126) {
-        frame.push_back(static_cast<char>(mask_bit | static_cast<unsigned char>(len)));
-    } else if (len <= 0xFFFF) {
-        frame.push_back(static_cast<char>(mask_bit | 126));
-        frame.push_back(static_cast<char>((len >> 8) & 0xFF));
-        frame.push_back(static_cast<char>(len & 0xFF));
-    } else {
-        frame.push_back(static_cast<char>(mask_bit | 127));
-        for (int i = 7; i >= 0; --i)
-            frame.push_back(static_cast<char>((len >> (i * 8)) & 0xFF));
-    }
-
-    unsigned char masking_key[4];
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dist(0, 255);
-    for (auto& byte : masking_key)
-        byte = static_cast<unsigned char>(dist(gen));
-
-    frame.append(reinterpret_cast<char*>(masking_key), sizeof(masking_key));
-
-    for (size_t i = 0; i < len; ++i)
-        frame.push_back(static_cast<char>(payload[i] ^ masking_key[i % 4]));
-
-    return frame;
+void ConnectionManager::WriteBufferedData() {
+    DrainSendQueue();
+    if (tls_enabled)
+        WriteBufferedTLS();
+    else
+        WriteBufferedPlain();
 }
 
-void ConnectionManager::WriteBufferedData() {
+// Marks bytes as sent, popping every fully written entry.
+void ConnectionManager::AdvanceWriteBuffer(size_t bytes) {
+    stats_add(stats.bytes_out, bytes);
+    uint64_t now = 0;
+    // Empty entries are dropped even when nothing was written, so a writer cannot spin on one.
     while (!writeBuffer.empty()) {
-        const std::string& data = writeBuffer.front();
-        std::string wire_data = websocket_mode ? encode_websocket_frame(data) : data;
-        ssize_t bytesSent = transport_write(wire_data.c_str(), wire_data.size());
-
-        if (bytesSent < 0)
-            return;
-
-        if (bytesSent < static_cast<ssize_t>(wire_data.size())) {
-            if (websocket_mode) {
-                ui.print(NC_RED) << "Partial WebSocket write not supported" << std::endl;
-                stop_program = 1;
-            } else {
-                writeBuffer.front() = data.substr(bytesSent);
-            }
+        size_t remaining = writeBuffer.front().data.size() - write_offset;
+        if (bytes < remaining) {
+            write_offset += bytes;
             return;
         }
-
+        bytes -= remaining;
+        if (now == 0)
+            now = stats_now_ns();
+        stats.stage[STAGE_SEND_TO_WRITE].Record(now - writeBuffer.front().queued_ns);
         writeBuffer.pop_front();
+        write_offset = 0;
+        stats_add(stats.entries_out);
     }
 }
 
-bool ConnectionManager::decode_websocket_frames(std::string& ws_buffer) {
-    while (ws_buffer.size() >= 2) {
-        unsigned char b0 = static_cast<unsigned char>(ws_buffer[0]);
-        unsigned char b1 = static_cast<unsigned char>(ws_buffer[1]);
-        bool fin = (b0 & 0x80) != 0;
-        unsigned char opcode = b0 & 0x0F;
-        bool masked = (b1 & 0x80) != 0;
-        uint64_t payload_len = b1 & 0x7F;
-        size_t header_len = 2;
-
-        if (payload_len == 126) {
-            if (ws_buffer.size() < 4)
-                return false;
-            payload_len = (static_cast<uint64_t>(static_cast<unsigned char>(ws_buffer[2])) << 8) |
-                          static_cast<unsigned char>(ws_buffer[3]);
-            header_len = 4;
-        } else if (payload_len == 127) {
-            if (ws_buffer.size() < 10)
-                return false;
-            payload_len = 0;
-            for (int i = 0; i < 8; ++i)
-                payload_len = (payload_len << 8) | static_cast<unsigned char>(ws_buffer[2 + i]);
-            header_len = 10;
+// Flushes the queue with as few writev() calls as the socket allows.
+void ConnectionManager::WriteBufferedPlain() {
+    while (!writeBuffer.empty()) {
+        struct iovec iov[MAX_WRITE_IOVECS];
+        int count = 0;
+        size_t total = 0;
+        for (auto it = writeBuffer.begin(); it != writeBuffer.end() && count < MAX_WRITE_IOVECS; ++it, ++count) {
+            size_t skip = (count == 0) ? write_offset : 0;
+            iov[count].iov_base = const_cast<char*>(it->data.data()) + skip;
+            iov[count].iov_len = it->data.size() - skip;
+            total += iov[count].iov_len;
         }
 
-        size_t mask_len = masked ? 4 : 0;
-        if (ws_buffer.size() < header_len + mask_len + payload_len)
-            return false;
+        ssize_t bytesSent = transport_writev(iov, count);
+        stats_add(stats.write_calls);
+        if (bytesSent < 0)
+            return;
 
-        const unsigned char* mask = masked
-            ? reinterpret_cast<const unsigned char*>(ws_buffer.data() + header_len)
-            : nullptr;
-        size_t payload_offset = header_len + mask_len;
+        AdvanceWriteBuffer(static_cast<size_t>(bytesSent));
+        if (static_cast<size_t>(bytesSent) < total)
+            return; // Socket buffer is full; wait for POLLOUT.
+    }
+}
 
-        if (opcode == 0x8) {
-            ui.print(NC_RED) << "WebSocket connection closed by server" << std::endl;
-            stop_program = 1;
-            return false;
+// Coalesces queued lines into record-sized SSL_write() calls. A record that could not be written
+// stays in tls_record untouched, as OpenSSL requires the same data to be retried.
+void ConnectionManager::WriteBufferedTLS() {
+    while (!tls_record.empty() || !writeBuffer.empty()) {
+        while (tls_record.size() < TLS_RECORD_SIZE && !writeBuffer.empty()) {
+            const QueuedData& front = writeBuffer.front();
+            size_t n = std::min(front.data.size() - write_offset, TLS_RECORD_SIZE - tls_record.size());
+            tls_record.append(front.data, write_offset, n);
+            write_offset += n;
+            if (write_offset == front.data.size()) {
+                tls_record_queued.push_back(front.queued_ns);
+                writeBuffer.pop_front();
+                write_offset = 0;
+            }
         }
 
-        if (opcode == 0x9 || opcode == 0xA) {
-            ws_buffer.erase(0, payload_offset + payload_len);
-            continue;
-        }
+        ssize_t bytesSent = transport_write(tls_record.data(), tls_record.size());
+        stats_add(stats.write_calls);
+        if (bytesSent < 0)
+            return;
 
-        if (opcode != 0x1 && opcode != 0x2 && opcode != 0x0) {
-            ws_buffer.erase(0, payload_offset + payload_len);
-            continue;
-        }
+        // Without SSL_MODE_ENABLE_PARTIAL_WRITE, SSL_write() succeeds only once the whole record is sent.
+        uint64_t now = stats_now_ns();
+        for (uint64_t queued : tls_record_queued)
+            stats.stage[STAGE_SEND_TO_WRITE].Record(now - queued);
+        stats_add(stats.bytes_out, tls_record.size());
+        stats_add(stats.entries_out, tls_record_queued.size());
+        tls_record.clear();
+        tls_record_queued.clear();
+    }
+}
 
-        std::string payload(payload_len, '\0');
-        for (uint64_t i = 0; i < payload_len; ++i) {
-            unsigned char byte = static_cast<unsigned char>(ws_buffer[payload_offset + i]);
-            if (mask)
-                byte ^= mask[i % 4];
-            payload[static_cast<size_t>(i)] = static_cast<char>(byte);
+// Decodes every complete frame in the receive buffer. Control frames are answered here,
+// on the receive thread, ahead of anything still waiting in the send queue.
+void ConnectionManager::process_websocket_data() {
+    while (!stop_program && !closed) {
+        size_t consumed = 0;
+        uint64_t decode_start = stats_now_ns();
+        WsDecoder::Event event = ws_decoder.Next(buffer.ReadPtr(), buffer.Size(), consumed);
+
+        switch (event) {
+        case WsDecoder::Event::NeedMore:
+            buffer.Consume(consumed);
+            return;
+        case WsDecoder::Event::Message:
+            if (ws_decoder.Compressed()) {
+                if (!ws_deflate.Decompress(ws_decoder.Payload(), ws_scratch, WS_MAX_MESSAGE)) {
+                    ui.print(NC_RED) << "WebSocket protocol error: bad or oversized compressed message" << std::endl;
+                    closed = true;
+                    return;
+                }
+                stats.stage[STAGE_WS_DECODE].Record(stats_now_ns() - decode_start);
+                dispatch_websocket_message(ws_scratch);
+            } else {
+                stats.stage[STAGE_WS_DECODE].Record(stats_now_ns() - decode_start);
+                dispatch_websocket_message(ws_decoder.Payload());
+            }
+            break;
+        case WsDecoder::Event::Ping:
+            queue_websocket_control(WS_OPCODE_PONG, ws_decoder.Payload());
+            break;
+        case WsDecoder::Event::Pong:
+            break;
+        case WsDecoder::Event::Close: {
+            std::string_view reason = ws_decoder.Payload();
+            // Echo the status code back; the final flush in Finish() sends it.
+            queue_websocket_control(WS_OPCODE_CLOSE, reason.substr(0, 2));
+            ui.print(NC_RED) << "WebSocket connection closed by server"
+                             << (reason.size() > 2 ? ": " + std::string(reason.substr(2)) : "") << std::endl;
+            closed = true;
+            break;
         }
-
-        ws_buffer.erase(0, payload_offset + payload_len);
-
-        if (fin) {
-            std::string parsed_line = payload;
-            strip_ircv3_message_tags(parsed_line);
-            mod->Parse(payload, parsed_line);
+        case WsDecoder::Event::Error:
+            ui.print(NC_RED) << "WebSocket protocol error: " << ws_decoder.Error() << std::endl;
+            closed = true;
+            return;
         }
+        buffer.Consume(consumed);
     }
+}
 
-    return true;
+// A text frame may carry several IRC lines; each is parsed in place.
+void ConnectionManager::dispatch_websocket_message(std::string_view message) {
+    IrcMessage msg;
+    uint64_t now = stats_now_ns();
+    while (!message.empty()) {
+        size_t end = message.find('\n');
+        std::string_view line = message.substr(0, end);
+        message.remove_prefix(end == std::string_view::npos ? message.size() : end + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (!line.empty() && parse_irc_message(line, msg))
+            parse_line(msg, now);
+    }
+}
+
+// Compression ratio and CPU cost per megabyte of uncompressed data, per direction.
+void ConnectionManager::report_deflate_stats() {
+    const WsDeflate::Stats& st = ws_deflate.GetStats();
+    auto line = [this](const char* what, uint64_t raw, uint64_t wire, uint64_t ns) {
+        double mb = raw / 1e6;
+        ui.print(NC_YELLOW) << "permessage-deflate " << what << ": " << mb << " MB as " << wire / 1e6 << " MB ("
+                            << (raw ? 100.0 * wire / raw : 0.0) << "%), "
+                            << (mb > 0 ? ns / 1e6 / mb : 0.0) << " ms CPU/MB" << std::endl;
+    };
+    line("sent", st.raw_out, st.wire_out, st.deflate_ns);
+    line("received", st.raw_in, st.wire_in, st.inflate_ns);
+}
+
+void ConnectionManager::queue_websocket_control(unsigned char opcode, std::string_view payload) {
+    std::string frame;
+    ws_encode_frame(frame, opcode, payload, ws_masks);
+    writeBuffer.push_back({ std::move(frame), stats_now_ns() });
 }
 
 bool ConnectionManager::PerformWebSocketHandshake() {
-    if (ws_handshake_retries >= 50) {
-        ui.print(NC_RED) << "WebSocket handshake failed after multiple attempts. Exiting." << std::endl;
-        stop_program = true;
+    if (std::chrono::steady_clock::now() >= handshake_deadline) {
+        ui.print(NC_RED) << "WebSocket handshake timed out. Exiting." << std::endl;
+        closed = true;
         return false;
     }
 
@@ -325,19 +554,22 @@ bool ConnectionManager::PerformWebSocketHandshake() {
                 << "Connection: Upgrade\r\n"
                 << "Sec-WebSocket-Key: " << ws_key << "\r\n"
                 << "Sec-WebSocket-Version: 13\r\n"
-                << "Sec-WebSocket-Protocol: text.ircv3.net, binary.ircv3.net\r\n"
-                << "\r\n";
+                << "Sec-WebSocket-Protocol: text.ircv3.net, binary.ircv3.net\r\n";
+        if (ws_deflate_offer_config.enabled)
+            request << "Sec-WebSocket-Extensions: " << ws_deflate_offer(ws_deflate_offer_config) << "\r\n";
+        request << "\r\n";
 
         std::string req = request.str();
         ssize_t sent = transport_write(req.c_str(), req.size());
         if (sent < 0) {
-            ws_handshake_retries++;
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            // Socket not writable yet: resend the request with a fresh key once it is.
+            ws_key.clear();
+            handshake_events = POLLOUT;
             return false;
         }
         if (sent < static_cast<ssize_t>(req.size())) {
             ui.print(NC_RED) << "Failed to send WebSocket handshake request" << std::endl;
-            stop_program = true;
+            closed = true;
             return false;
         }
     }
@@ -345,22 +577,23 @@ bool ConnectionManager::PerformWebSocketHandshake() {
     char temp_buffer[512];
     ssize_t bytes_received = transport_read(temp_buffer, sizeof(temp_buffer) - 1);
     if (bytes_received < 0) {
-        ws_handshake_retries++;
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        handshake_events = POLLIN;
         return false;
     }
 
     if (bytes_received == 0) {
         ui.print(NC_RED) << "Connection closed during WebSocket handshake" << std::endl;
-        stop_program = true;
+        closed = true;
         return false;
     }
 
     ws_buffer.append(temp_buffer, bytes_received);
 
     size_t header_end = ws_buffer.find("\r\n\r\n");
-    if (header_end == std::string::npos)
+    if (header_end == std::string::npos) {
+        handshake_events = POLLIN;
         return false;
+    }
 
     std::string response = ws_buffer.substr(0, header_end);
     ws_buffer.erase(0, header_end + 4);
@@ -368,14 +601,14 @@ bool ConnectionManager::PerformWebSocketHandshake() {
     if (response.find("HTTP/1.1 101") == std::string::npos &&
         response.find("HTTP/1.0 101") == std::string::npos) {
         ui.print(NC_RED) << "WebSocket handshake rejected by server" << std::endl;
-        stop_program = true;
+        closed = true;
         return false;
     }
 
     size_t accept_pos = response.find("Sec-WebSocket-Accept:");
     if (accept_pos == std::string::npos) {
         ui.print(NC_RED) << "WebSocket handshake missing Sec-WebSocket-Accept" << std::endl;
-        stop_program = true;
+        closed = true;
         return false;
     }
 
@@ -390,72 +623,204 @@ bool ConnectionManager::PerformWebSocketHandshake() {
     std::string expected = sha1_base64(ws_key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
     if (accept_value != expected) {
         ui.print(NC_RED) << "WebSocket handshake accept key mismatch" << std::endl;
-        stop_program = true;
+        closed = true;
         return false;
     }
 
+    size_t ext_pos = response.find("Sec-WebSocket-Extensions:");
+    if (ext_pos != std::string::npos) {
+        size_t ext_start = ext_pos + strlen("Sec-WebSocket-Extensions:");
+        size_t ext_end = response.find("\r\n", ext_start);
+        std::string_view ext_value = std::string_view(response).substr(ext_start, ext_end - ext_start);
+        WsDeflateConfig agreed;
+        if (!ws_deflate_offer_config.enabled || !ws_deflate_accept(ext_value, ws_deflate_offer_config, agreed)) {
+            ui.print(NC_RED) << "WebSocket handshake: server chose an extension we did not offer" << std::endl;
+            closed = true;
+            return false;
+        }
+        if (agreed.enabled && ws_deflate.Init(agreed)) {
+            ws_decoder.AllowCompression(true);
+            ui.print(NC_YELLOW) << "permessage-deflate enabled (client window " << agreed.client_max_window_bits
+                                << " bits" << (agreed.client_no_context_takeover ? ", no context takeover" : "")
+                                << "; server window " << agreed.server_max_window_bits << " bits"
+                                << (agreed.server_no_context_takeover ? ", no context takeover" : "") << ")" << std::endl;
+        }
+    }
+
     ui.print(NC_YELLOW) << "WebSocket handshake successful!" << std::endl;
     ws_handshake_done = true;
+    capture.WebSocket(ws_deflate.Active() ? ws_deflate.Config() : WsDeflateConfig());
+
+    // Frames that arrived together with the response headers.
+    size_t leftover = std::min(ws_buffer.size(), buffer.Writable());
+    std::memcpy(buffer.WritePtr(), ws_buffer.data(), leftover);
+    if (leftover > 0)
+        capture_data(ws_buffer.data(), leftover);
+    read_ns = stats_now_ns();
+    buffer.Commit(leftover);
+    ws_buffer.clear();
+    process_websocket_data();
     return true;
 }
 
-void ConnectionManager::MainLoop() {
-    while (!stop_program) {
-        if (tls_enabled && !tls_handshake_done) {
-            if (!PerformTLSHandshake())
-                continue;
+void ConnectionManager::Finish() {
+    finished = true;
+
+    // Best effort: push out anything queued right before shutdown (e.g. QUIT or SQ).
+    if ((!tls_enabled || tls_handshake_done) && (!websocket_mode || ws_handshake_done))
+        WriteBufferedData();
+
+    uint64_t entries = stats.entries_out.load(std::memory_order_relaxed);
+    uint64_t write_calls = stats.write_calls.load(std::memory_order_relaxed);
+    uint64_t lines = entries + (entries > 0 ? raw_extra_lines.load() : 0);
+    if (lines > 0) {
+        ui.print(NC_YELLOW) << label << "Flushed " << lines << " lines in " << write_calls << " write calls ("
+                            << static_cast<double>(write_calls) / lines << " calls/line)" << std::endl;
+    }
+
+    if (ws_deflate.Active())
+        report_deflate_stats();
+}
+
+// Sent data has nowhere to go during a replay.
+void ConnectionManager::DiscardSendQueue() {
+    QueuedData entry;
+    int64_t drained = 0;
+    while (sendQueue.Pop(entry))
+        drained++;
+    stats.send_queue.fetch_sub(drained, std::memory_order_relaxed);
+    writeBuffer.clear();
+}
+
+// Each recorded chunk goes through the same buffer and framing code as a live read. Timers are
+// not run, so the module sees exactly the recorded input.
+void ConnectionManager::ReplayLoop() {
+    CaptureReader reader;
+    std::string error;
+    if (!reader.Open(replay_file, error)) {
+        ui.print(NC_RED) << error << std::endl;
+        stop_program = 1;
+        return;
+    }
+
+    uint64_t chunks = 0, bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    CaptureReader::Record record;
+    while (!stop_program && !closed && reader.Next(record)) {
+        if (replay_paced) {
+            auto due = start + std::chrono::nanoseconds(record.time_ns);
+            // Sleep in short steps so that a signal still ends the replay promptly.
+            while (!stop_program && std::chrono::steady_clock::now() < due)
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                    due - std::chrono::steady_clock::now(), std::chrono::milliseconds(100)));
         }
-        if (websocket_mode && !ws_handshake_done) {
-            if (!PerformWebSocketHandshake())
-                continue;
+
+        if (record.type == CAPTURE_WEBSOCKET) {
+            WsDeflateConfig agreed;
+            websocket_mode = ws_handshake_done = true;
+            if (CaptureReader::DecodeWebSocket(record.data, agreed) && agreed.enabled && ws_deflate.Init(agreed))
+                ws_decoder.AllowCompression(true);
+            continue;
         }
+        if (record.type != CAPTURE_DATA)
+            continue;
 
-        receive_message(buffer);
-        WriteBufferedData();
+        chunks++;
+        bytes += record.data.size();
+        std::string_view data = record.data;
+        while (!data.empty() && !stop_program && !closed) {
+            buffer.Compact();
+            size_t n = std::min(data.size(), buffer.Writable());
+            std::memcpy(buffer.WritePtr(), data.data(), n);
+            buffer.Commit(n);
+            read_ns = stats_now_ns();
+            stats_add(stats.bytes_in, n);
+            data.remove_prefix(n);
+            if (websocket_mode)
+                process_websocket_data();
+            else
+                process_received_data();
+        }
+        DiscardSendQueue();
     }
+
+    if (reader.Truncated())
+        ui.print(NC_RED) << "Capture ends with a truncated record" << std::endl;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint64_t lines = stats.lines_in.load(std::memory_order_relaxed);
+    ui.print(NC_YELLOW) << "Replayed " << chunks << " chunks, " << bytes << " bytes, " << lines << " lines in "
+                        << ms << " ms (" << (ms > 0 ? lines * 1000.0 / ms : 0.0) << " lines/s)" << std::endl;
+    if (ws_deflate.Active())
+        report_deflate_stats();
+    stop_program = 1;
 }
 
-std::string ConnectionManager::receive_message(std::string &buffer) {
-    char temp_buffer[512];
-    memset(temp_buffer, 0, sizeof(temp_buffer));
-    ssize_t bytes_received = transport_read(temp_buffer, sizeof(temp_buffer) - 1);
+void ConnectionManager::receive_message() {
+    // Drain the socket: poll() is level-triggered, but TLS may hold decrypted records that poll() cannot see.
+    for (int reads = 0; reads < MAX_READS_PER_WAKEUP && !stop_program && !closed; ++reads) {
+        buffer.Compact();
+        uint64_t start = stats_now_ns();
+        ssize_t bytes_received = transport_read(buffer.WritePtr(), buffer.Writable());
+        read_ns = stats_now_ns();
+        stats_add(stats.read_calls);
 
-    if (bytes_received < 0)
-        return "";
+        if (bytes_received < 0)
+            return;
 
-    if (bytes_received == 0) {
-        ui.print(NC_RED) << "Connection closed by server" << std::endl;
-        close(sockfd);
-        stop_program = 1;
-        return "";
+        if (bytes_received == 0) {
+            ui.print(NC_RED) << label << "Connection closed by server" << std::endl;
+            closed = true;
+            return;
+        }
+
+        if (tls_enabled)
+            stats.stage[STAGE_TLS_READ].Record(read_ns - start);
+        stats_add(stats.bytes_in, bytes_received);
+        capture_data(buffer.WritePtr(), bytes_received);
+        buffer.Commit(bytes_received);
+
+        if (websocket_mode)
+            process_websocket_data();
+        else
+            process_received_data();
+        stats.recv_buffered.store(buffer.Size(), std::memory_order_relaxed);
     }
+}
+
+void ConnectionManager::process_received_data() {
+    std::string_view data = buffer.Data();
 
-    if (websocket_mode) {
-        ws_buffer.append(temp_buffer, bytes_received);
-        decode_websocket_frames(ws_buffer);
-        return buffer;
+    // Parse each complete line in place in the receive buffer, then advance past them.
+    uint64_t now = stats_now_ns();
+    size_t start = for_each_irc_line(data, [this, &now](const IrcMessage& msg) { parse_line(msg, now); });
+
+    // A line longer than the whole buffer can never complete; hand it over as is.
+    if (start == 0 && buffer.Full()) {
+        IrcMessage msg;
+        if (parse_irc_message(data, msg))
+            parse_line(msg, now);
+        start = data.size();
     }
 
-    buffer += temp_buffer;
-    process_received_data(buffer);
-    return buffer;
+    buffer.Consume(start);
 }
 
-void ConnectionManager::process_received_data(std::string &buffer) {
-    std::string::size_type end;
-    while ((end = buffer.find("\r\n")) != std::string::npos) {
-        std::string display_line = buffer.substr(0, end);
-        std::string parsed_line = display_line;
-        strip_ircv3_message_tags(parsed_line);
-        mod->Parse(display_line, parsed_line);
-        buffer.erase(0, end + 2);
-    }
+// Hands one line to the module, recording how long it waited since the read and how long it took.
+// 'now' is the time the line became ready and is advanced to the time Parse() returned.
+void ConnectionManager::parse_line(const IrcMessage& msg, uint64_t& now) {
+    stats_add(stats.lines_in);
+    stats.stage[STAGE_READ_TO_PARSE].Record(now - read_ns);
+    mod->Receive(this, msg);
+    uint64_t done = stats_now_ns();
+    stats.stage[STAGE_PARSE_TO_PRINT].Record(done - now);
+    now = done;
 }
 
 bool ConnectionManager::PerformTLSHandshake() {
-    if (tls_handshake_retries >= 10) {
-        ui.print(NC_RED) << "TLS handshake failed after multiple attempts. Exiting." << std::endl;
-        stop_program = true;
+    if (std::chrono::steady_clock::now() >= handshake_deadline) {
+        ui.print(NC_RED) << "TLS handshake timed out. Exiting." << std::endl;
+        closed = true;
         return false;
     }
 
@@ -495,7 +860,7 @@ bool ConnectionManager::PerformTLSHandshake() {
                 std::cerr   << RED << "Certificate verification failed: "
                             << X509_verify_cert_error_string(verify_result) << RESET << std::endl;
                 X509_free(cert);
-                stop_program = true;
+                closed = true;
                 return false;
             }
             char* subject = X509_NAME_oneline(X509_get_subject_name(cert), nullptr, 0);
@@ -510,7 +875,7 @@ bool ConnectionManager::PerformTLSHandshake() {
             X509_free(cert);
         } else {
             ui.print(NC_YELLOW) << "No server certificate was provided!" << std::endl;
-            stop_program = true;
+            closed = true;
             return false;
         }
 
@@ -520,8 +885,7 @@ bool ConnectionManager::PerformTLSHandshake() {
 
     int err = SSL_get_error(ssl, ret);
     if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-        tls_handshake_retries++;
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        handshake_events = (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
         return false;
     }
 
@@ -532,7 +896,7 @@ bool ConnectionManager::PerformTLSHandshake() {
         ui.print(NC_RED) << "  " << buf << std::endl;
     }
     cleanup_tls();
-    stop_program = true;
+    closed = true;
     return false;
 }
 
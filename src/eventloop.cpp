@@ -0,0 +1,136 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+#include "connection.h"
+
+EventLoop::EventLoop(UIManager& _ui) : ui(_ui) {
+    if (pipe(wakeup_fds) == -1) {
+        ui.fatal("Error creating wakeup pipe: " + std::string(strerror(errno)));
+    }
+    for (int fd : wakeup_fds) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            ui.fatal("Error setting wakeup pipe to non-blocking mode: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+EventLoop::~EventLoop() {
+    Stop();
+    for (int fd : wakeup_fds) {
+        if (fd != -1)
+            close(fd);
+    }
+}
+
+void EventLoop::Add(ConnectionManager* conn) {
+    conn->loop = this;
+    conns.push_back(conn);
+}
+
+void EventLoop::Start() {
+    thread = std::thread([this] { Run(); });
+}
+
+void EventLoop::Stop() {
+    Wakeup();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void EventLoop::Wakeup() {
+    // A full pipe already guarantees a pending wakeup, so EAGAIN is harmless here.
+    char byte = 0;
+    [[maybe_unused]] ssize_t ret = write(wakeup_fds[1], &byte, 1);
+}
+
+void EventLoop::Notify() {
+    // The loop clears the flag before it drains the send queues.
+    if (!wakeup_pending.exchange(true, std::memory_order_acq_rel))
+        Wakeup();
+}
+
+void EventLoop::Run() {
+    std::vector<struct pollfd> fds(conns.size() + 1);
+    std::vector<short> revents(conns.size(), 0);
+
+    while (!stop_program) {
+        // Every connection runs once per wakeup: a send queue, a timer or a handshake may need it
+        // even when its socket is quiet.
+        size_t open = 0;
+        for (size_t i = 0; i < conns.size() && !stop_program; ++i) {
+            ConnectionManager* conn = conns[i];
+            if (!conn->closed)
+                conn->Process(revents[i]);
+            if (conn->closed && !conn->finished)
+                conn->Finish();
+            if (!conn->closed)
+                open++;
+        }
+        if (open == 0)
+            stop_program = 1;
+        if (stop_program)
+            break;
+
+        int timeout = -1;
+        for (size_t i = 0; i < conns.size(); ++i) {
+            ConnectionManager* conn = conns[i];
+            fds[i].fd = conn->closed ? -1 : conn->sockfd;
+            fds[i].events = conn->PollEvents();
+            fds[i].revents = 0;
+            if (conn->closed)
+                continue;
+            stats_add(conn->stats.poll_calls);
+            int t = conn->PollTimeout();
+            if (t >= 0 && (timeout < 0 || t < timeout))
+                timeout = t;
+        }
+        fds.back().fd = wakeup_fds[0];
+        fds.back().events = POLLIN;
+        fds.back().revents = 0;
+
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            ui.print(NC_RED) << "Error polling sockets: " << strerror(errno) << std::endl;
+            stop_program = 1;
+            break;
+        }
+
+        if (fds.back().revents & POLLIN) {
+            char drain[64];
+            while (read(wakeup_fds[0], drain, sizeof(drain)) > 0) { }
+            wakeup_pending.store(false, std::memory_order_release);
+        }
+        for (size_t i = 0; i < conns.size(); ++i)
+            revents[i] = fds[i].revents;
+    }
+
+    for (ConnectionManager* conn : conns) {
+        if (!conn->finished)
+            conn->Finish();
+    }
+}
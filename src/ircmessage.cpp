@@ -0,0 +1,88 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include "ircmessage.h"
+
+static size_t skip_spaces(std::string_view line, size_t pos) {
+    while (pos < line.size() && line[pos] == ' ')
+        ++pos;
+    return pos;
+}
+
+static std::string_view next_word(std::string_view line, size_t& pos) {
+    size_t end = line.find(' ', pos);
+    if (end == std::string_view::npos)
+        end = line.size();
+    std::string_view word = line.substr(pos, end - pos);
+    pos = end;
+    return word;
+}
+
+bool parse_irc_message(std::string_view line, IrcMessage& msg) {
+    msg.raw = line;
+    msg.tags = {};
+    msg.source = {};
+    msg.command = {};
+    msg.param_count = 0;
+
+    // Tag keys/values cannot contain raw spaces (they use \s); first ASCII space ends the tag block.
+    size_t pos = 0;
+    if (!line.empty() && line[0] == '@') {
+        pos = 1;
+        msg.tags = next_word(line, pos);
+    }
+    pos = skip_spaces(line, pos);
+    msg.line = line.substr(pos);
+
+    if (pos < line.size() && line[pos] == ':') {
+        ++pos;
+        msg.source = next_word(line, pos);
+        pos = skip_spaces(line, pos);
+    }
+
+    msg.command = next_word(line, pos);
+    if (msg.command.empty())
+        return false;
+
+    while ((pos = skip_spaces(line, pos)) < line.size()) {
+        if (line[pos] == ':') {
+            msg.params[msg.param_count++] = line.substr(pos + 1);
+            break;
+        }
+        if (msg.param_count == IRC_MAX_PARAMS - 1) {
+            msg.params[msg.param_count++] = line.substr(pos);
+            break;
+        }
+        msg.params[msg.param_count++] = next_word(line, pos);
+    }
+
+    return true;
+}
+
+void p10_normalize(IrcMessage& msg) {
+    if (!msg.source.empty() || msg.param_count == 0)
+        return;
+    if (msg.command == "PASS" || msg.command == "SERVER" || msg.command == "ERROR")
+        return;
+
+    msg.source = msg.command;
+    msg.command = msg.params[0];
+    for (size_t i = 1; i < msg.param_count; ++i)
+        msg.params[i - 1] = msg.params[i];
+    msg.param_count--;
+}
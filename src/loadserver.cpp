@@ -0,0 +1,643 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+// Loopback stand-in for an ircd (RFC 1459) or a P10 hub, for end-to-end throughput and latency
+// tests of telnIRC and telnERV. It accepts one client over TCP, TLS or WebSocket, registers or
+// links it, then floods a traffic mix at a fixed rate. Interleaved probes (CTCP PING for clients,
+// G for servers) are answered from the module's Parse(); their round trip gives the latency.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "ircmessage.h"
+#include "misc.h"
+#include "numeric.h"
+#include "websocket.h"
+
+// Outgoing bytes buffered before generation pauses for the client to catch up.
+#define LOAD_MAX_BACKLOG (256 * 1024)
+// Pre-generated message texts cycled through by the flood.
+#define LOAD_TEXT_POOL 256
+
+enum LoadEvent { LOAD_PRIVMSG, LOAD_NOTICE, LOAD_JOIN, LOAD_PART, LOAD_QUIT, LOAD_NICK, LOAD_EVENTS };
+static const char* const event_names[LOAD_EVENTS] = { "privmsg", "notice", "join", "part", "quit", "nick" };
+
+static volatile sig_atomic_t stop = 0;
+static void handle_signal(int) { stop = 1; }
+
+struct Options {
+    unsigned int port = 6667;
+    bool p10 = false;
+    bool websocket = false;
+    std::string cert;
+    std::string key;
+    double rate = 10000;         // Lines per second.
+    unsigned int duration = 10;  // Seconds of flooding.
+    unsigned int probe_ms = 10;
+    unsigned int users = 1000;
+    unsigned int channels = 20;
+    unsigned int mix[LOAD_EVENTS] = { 80, 0, 5, 5, 5, 5 };
+};
+
+static bool parse_mix(const char* arg, unsigned int mix[LOAD_EVENTS]) {
+    std::fill(mix, mix + LOAD_EVENTS, 0);
+    unsigned int total = 0;
+    std::string list = arg;
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        std::string item = list.substr(start, end - start);
+        size_t colon = item.find(':');
+        unsigned int event = 0;
+        while (event < LOAD_EVENTS && item.compare(0, colon, event_names[event]) != 0)
+            ++event;
+        if (colon == std::string::npos || event == LOAD_EVENTS)
+            return false;
+        mix[event] = static_cast<unsigned int>(atoi(item.c_str() + colon + 1));
+        total += mix[event];
+        start = end + 1;
+    }
+    return total > 0;
+}
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// The accepted client: transport I/O plus line framing.
+class Link {
+public:
+    int fd = -1;
+    SSL* ssl = nullptr;
+    bool websocket = false;
+    std::string in;
+    std::string out;
+    size_t out_offset = 0;
+    uint64_t lines_queued = 0;
+
+    // Returns bytes read, 0 when nothing is available, -1 once the client is gone.
+    ssize_t Read(char* buf, size_t len) {
+        if (ssl) {
+            int n = SSL_read(ssl, buf, static_cast<int>(len));
+            if (n > 0)
+                return n;
+            int err = SSL_get_error(ssl, n);
+            return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? 0 : -1;
+        }
+        ssize_t n = read(fd, buf, len);
+        if (n > 0)
+            return n;
+        return (n < 0 && (errno == EAGAIN || errno == EINTR)) ? 0 : -1;
+    }
+
+    // Writes as much of the backlog as the socket takes. Returns false once the client is gone.
+    bool Flush() {
+        while (out_offset < out.size()) {
+            ssize_t n;
+            if (ssl) {
+                int r = SSL_write(ssl, out.data() + out_offset, static_cast<int>(out.size() - out_offset));
+                if (r <= 0) {
+                    int err = SSL_get_error(ssl, r);
+                    return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+                }
+                n = r;
+            } else {
+                n = send(fd, out.data() + out_offset, out.size() - out_offset, MSG_NOSIGNAL);
+                if (n < 0)
+                    return errno == EAGAIN || errno == EINTR;
+            }
+            out_offset += n;
+        }
+        out.clear();
+        out_offset = 0;
+        return true;
+    }
+
+    size_t Backlog() const { return out.size() - out_offset; }
+
+    void Queue(std::string_view line) {
+        lines_queued++;
+        if (!websocket) {
+            out += line;
+            out += "\r\n";
+            return;
+        }
+        // Server frames are unmasked.
+        out += static_cast<char>(0x80 | WS_OPCODE_TEXT);
+        if (line.size() < 126) {
+            out += static_cast<char>(line.size());
+        } else {
+            out += static_cast<char>(126);
+            out += static_cast<char>(line.size() >> 8);
+            out += static_cast<char>(line.size() & 0xff);
+        }
+        out += line;
+    }
+};
+
+/// Registration, flood generation and latency bookkeeping for one client.
+class LoadServer {
+public:
+    LoadServer(const Options& opts, Link& link) : opts(opts), link(link), rng(1) {
+        static const char* const words[] = {
+            "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "netsplit", "again", "anyone",
+            "here", "rehash", "services", "lol", "ok", "café", "日本語", "🙂", "https://example.org/path?q=1",
+        };
+        for (unsigned int i = 0; i < LOAD_TEXT_POOL; ++i) {
+            std::string text;
+            for (unsigned int w = 0, count = 1 + rng() % 25; w < count; ++w)
+                text += std::string(w ? " " : "") + words[rng() % (sizeof(words) / sizeof(words[0]))];
+            texts.push_back(text);
+        }
+        for (unsigned int weight : opts.mix)
+            mix_total += weight;
+        renamed.resize(opts.users);
+    }
+
+    bool Flooding() const { return flooding; }
+    bool Finished() const { return finished; }
+
+    // Handles one line from the client.
+    void OnLine(const IrcMessage& line) {
+        IrcMessage msg = line;
+        if (opts.p10)
+            p10_normalize(msg);
+
+        if (msg.command == "PING") {
+            link.Queue(":load.server PONG load.server :" + std::string(msg.param(0)));
+        } else if (!opts.p10) {
+            OnClientLine(msg);
+        } else {
+            OnServerLine(msg);
+        }
+    }
+
+    // Queues every line due by now, then reports once a second.
+    void Generate(uint64_t now) {
+        if (!flooding)
+            return;
+        if (now >= flood_end) {
+            Report(now, true);
+            finished = true;
+            return;
+        }
+        // Paced in lines rather than events: a P10 quit is followed by the user's reintroduction.
+        uint64_t due = static_cast<uint64_t>((now - flood_start) * 1e-9 * opts.rate);
+        while (Sent() < due && link.Backlog() < LOAD_MAX_BACKLOG) {
+            if (now >= next_probe) {
+                Probe(now);
+                next_probe = now + opts.probe_ms * 1000000ull;
+            }
+            Emit();
+        }
+        if (now >= next_report)
+            Report(now, false);
+    }
+
+    // Milliseconds until Generate() has work again.
+    int Timeout(uint64_t now) const {
+        if (!flooding)
+            return 100;
+        uint64_t next = flood_start + static_cast<uint64_t>((Sent() + 1) / opts.rate * 1e9);
+        return next <= now ? 0 : static_cast<int>(std::min<uint64_t>((next - now) / 1000000 + 1, 100));
+    }
+
+private:
+    const Options& opts;
+    Link& link;
+    std::mt19937 rng;
+    std::vector<std::string> texts;
+    unsigned int mix_total = 0;
+    std::vector<uint32_t> renamed;  // Per user: NICK changes so far, to keep nicks unique.
+
+    std::string nick;
+    std::string user;
+    bool flooding = false;
+    bool finished = false;
+    uint64_t flood_start = 0;
+    uint64_t flood_end = 0;
+    uint64_t next_probe = 0;
+    uint64_t next_report = 0;
+    uint64_t last_report = 0;
+    uint64_t lines_at_report = 0;
+    uint64_t lines_at_start = 0;
+    std::vector<uint64_t> latencies;      // Since the last report, in ns.
+    std::vector<uint64_t> all_latencies;
+
+    uint64_t Sent() const { return link.lines_queued - lines_at_start; }
+
+    void OnClientLine(const IrcMessage& msg) {
+        if (msg.command == "CAP" && msg.param(0) == "LS") {
+            link.Queue(":load.server CAP * LS :");
+        } else if (msg.command == "NICK" && !flooding) {
+            nick = msg.param(0);
+        } else if (msg.command == "USER" && !flooding) {
+            user = msg.param(0);
+            if (nick.empty())
+                return;
+            link.Queue(":load.server 001 " + nick + " :Welcome to the telnIRC load server " + nick);
+            link.Queue(":load.server 002 " + nick + " :Your host is load.server");
+            link.Queue(":load.server 003 " + nick + " :This server was created today");
+            link.Queue(":load.server 004 " + nick + " load.server loadserver-1 iow biklmnopstv");
+            link.Queue(":load.server 376 " + nick + " :End of /MOTD command.");
+            Start();
+        } else if (msg.command == "NOTICE") {
+            // CTCP PING reply: "\1PING <ns>\1"
+            std::string_view text = msg.param(1);
+            if (text.rfind("\x01PING ", 0) == 0)
+                Sample(text.substr(6));
+        }
+    }
+
+    void OnServerLine(const IrcMessage& msg) {
+        if (msg.command == "SERVER" && !flooding) {
+            std::string ts = std::to_string(time(nullptr));
+            link.Queue("PASS :load");
+            link.Queue("SERVER load.server 1 " + ts + " " + ts + " J10 AB]]] +h6 :telnIRC load server");
+            // Burst our users, then end the burst; the flood starts once the leaf ends its own.
+            char numeric[4];
+            for (unsigned int n = 0; n < opts.users; ++n) {
+                inttobase64(numeric, n, 3);
+                link.Queue("AB N load" + std::to_string(n) + " 1 " + ts + " user" + std::to_string(n) + " host"
+                           + std::to_string(n) + ".load.server +i B]AAAB AB" + numeric + " :load user");
+            }
+            link.Queue("AB EB");
+        } else if (msg.command == "EB") {
+            link.Queue("AB EA");
+            Start();
+        } else if (msg.command == "Z") {
+            // <YY> Z <our YY> !<ns> ...
+            std::string_view token = msg.param(1);
+            if (!token.empty() && token[0] == '!')
+                Sample(token.substr(1));
+        }
+    }
+
+    void Start() {
+        flooding = true;
+        flood_start = last_report = now_ns();
+        flood_end = flood_start + opts.duration * 1000000000ull;
+        next_probe = flood_start;
+        next_report = flood_start + 1000000000ull;
+        lines_at_start = lines_at_report = link.lines_queued;
+        printf("Flooding %s at %.0f lines/s for %u s\n", opts.p10 ? "P10" : "RFC 1459", opts.rate, opts.duration);
+        fflush(stdout);
+    }
+
+    void Probe(uint64_t now) {
+        std::string ns = std::to_string(now);
+        if (opts.p10)
+            link.Queue("AB G !" + ns + " load.server " + ns);
+        else
+            link.Queue(":probe!probe@load.server PRIVMSG " + nick + " :\x01PING " + ns + "\x01");
+    }
+
+    void Sample(std::string_view sent) {
+        uint64_t ns = strtoull(std::string(sent).c_str(), nullptr, 10);
+        uint64_t now = now_ns();
+        if (ns > 0 && ns <= now)
+            latencies.push_back(now - ns);
+    }
+
+    void Emit() {
+        unsigned int pick = rng() % mix_total;
+        unsigned int event = 0;
+        while (pick >= opts.mix[event])
+            pick -= opts.mix[event++];
+
+        unsigned int n = rng() % opts.users;
+        std::string chan = "#load" + std::to_string(rng() % opts.channels);
+        const std::string& text = texts[rng() % texts.size()];
+        std::string who = Nick(n);
+
+        if (opts.p10) {
+            char numeric[4];
+            inttobase64(numeric, n, 3);
+            std::string src = std::string("AB") + numeric;
+            switch (event) {
+            case LOAD_PRIVMSG: link.Queue(src + " P " + chan + " :" + text); break;
+            case LOAD_NOTICE: link.Queue(src + " O " + chan + " :" + text); break;
+            case LOAD_JOIN: link.Queue(src + " J " + chan + " " + std::to_string(time(nullptr))); break;
+            case LOAD_PART: link.Queue(src + " L " + chan + " :" + text); break;
+            case LOAD_QUIT: {
+                // Reintroduce the user at once so the population stays the same.
+                std::string ts = std::to_string(time(nullptr));
+                link.Queue(src + " Q :" + text);
+                renamed[n]++;
+                link.Queue("AB N " + Nick(n) + " 1 " + ts + " user" + std::to_string(n) + " host" + std::to_string(n)
+                           + ".load.server +i B]AAAB " + src + " :load user");
+                break;
+            }
+            case LOAD_NICK:
+                renamed[n]++;
+                link.Queue(src + " N " + Nick(n) + " " + std::to_string(time(nullptr)));
+                break;
+            }
+            return;
+        }
+
+        std::string prefix = ":" + who + "!user" + std::to_string(n) + "@host" + std::to_string(n) + ".load.server";
+        switch (event) {
+        case LOAD_PRIVMSG: link.Queue(prefix + " PRIVMSG " + chan + " :" + text); break;
+        case LOAD_NOTICE: link.Queue(prefix + " NOTICE " + chan + " :" + text); break;
+        case LOAD_JOIN: link.Queue(prefix + " JOIN " + chan); break;
+        case LOAD_PART: link.Queue(prefix + " PART " + chan + " :" + text); break;
+        case LOAD_QUIT: link.Queue(prefix + " QUIT :" + text); break;
+        case LOAD_NICK:
+            renamed[n]++;
+            link.Queue(prefix + " NICK :" + Nick(n));
+            break;
+        }
+    }
+
+    std::string Nick(unsigned int n) const {
+        return "load" + std::to_string(n) + (renamed[n] ? "_" + std::to_string(renamed[n]) : "");
+    }
+
+    static uint64_t Percentile(std::vector<uint64_t>& values, double p) {
+        if (values.empty())
+            return 0;
+        size_t k = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+
+    void Report(uint64_t now, bool final) {
+        std::vector<uint64_t>& sample = final ? all_latencies : latencies;
+        if (final)
+            all_latencies.insert(all_latencies.end(), latencies.begin(), latencies.end());
+        uint64_t since = final ? flood_start : last_report;
+        uint64_t lines = link.lines_queued - (final ? lines_at_start : lines_at_report);
+        double seconds = (now - since) * 1e-9;
+        size_t probes = sample.size();
+        uint64_t p50 = Percentile(sample, 0.50);
+        uint64_t p99 = Percentile(sample, 0.99);
+        printf("%s %.0f lines/s, backlog %zu bytes, %zu probes, latency p50 %.1f us p99 %.1f us\n",
+               final ? "Sustained:" : "         ", lines / seconds, link.Backlog(), probes, p50 / 1e3, p99 / 1e3);
+        fflush(stdout);
+        if (!final) {
+            all_latencies.insert(all_latencies.end(), latencies.begin(), latencies.end());
+            latencies.clear();
+            last_report = now;
+            lines_at_report = link.lines_queued;
+            next_report = now + 1000000000ull;
+        }
+    }
+};
+
+static bool wait_for(int fd, short events) {
+    struct pollfd pfd = { fd, events, 0 };
+    return poll(&pfd, 1, 1000) >= 0 && !stop;
+}
+
+// Answers the client's HTTP upgrade request.
+static bool websocket_handshake(Link& link) {
+    char buf[4096];
+    while (link.in.find("\r\n\r\n") == std::string::npos) {
+        if (!wait_for(link.fd, POLLIN) || link.in.size() > 16384)
+            return false;
+        ssize_t n = link.Read(buf, sizeof(buf));
+        if (n < 0)
+            return false;
+        link.in.append(buf, n);
+    }
+    size_t end = link.in.find("\r\n\r\n") + 4;
+    std::string request = link.in.substr(0, end);
+    link.in.erase(0, end);
+
+    std::string lower = request;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    size_t key = lower.find("sec-websocket-key:");
+    if (key == std::string::npos)
+        return false;
+    key += 18;
+    size_t eol = request.find("\r\n", key);
+    std::string value = request.substr(key, eol - key);
+    value.erase(0, value.find_first_not_of(' '));
+    value.erase(value.find_last_not_of(' ') + 1);
+
+    link.out = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: " + sha1_base64(value + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11") + "\r\n\r\n";
+    while (link.Backlog() > 0) {
+        if (!link.Flush() || !wait_for(link.fd, POLLOUT))
+            return false;
+    }
+    return true;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "SYNTAX: %s [-P] [-p port] [-T cert key] [-W] [-r lines/s] [-d seconds] [-m mix] [-u users]\n"
+            "\t\t[-c channels] [-i probe_ms]\n"
+            "\t-P: Link a P10 server (telnERV) instead of registering a client (telnIRC)\n"
+            "\t-p: Port on 127.0.0.1. Default: 6667\n"
+            "\t-T: TLS with this certificate and key\n"
+            "\t-W: WebSocket\n"
+            "\t-r: Flood rate in lines per second. Default: 10000\n"
+            "\t-d: Flood duration in seconds. Default: 10\n"
+            "\t-m: Traffic mix. Default: privmsg:80,join:5,part:5,quit:5,nick:5 (also notice)\n"
+            "\t-u: Simulated users. Default: 1000\n"
+            "\t-c: Channels. Default: 20\n"
+            "\t-i: Milliseconds between latency probes. Default: 10\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-P") {
+            opts.p10 = true;
+        } else if (arg == "-W") {
+            opts.websocket = true;
+        } else if (arg == "-T" && i + 2 < argc) {
+            opts.cert = argv[++i];
+            opts.key = argv[++i];
+        } else if (arg == "-p" && has_value) {
+            opts.port = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (arg == "-r" && has_value) {
+            opts.rate = atof(argv[++i]);
+        } else if (arg == "-d" && has_value) {
+            opts.duration = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (arg == "-u" && has_value) {
+            opts.users = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (arg == "-c" && has_value) {
+            opts.channels = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (arg == "-i" && has_value) {
+            opts.probe_ms = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (arg == "-m" && has_value) {
+            if (!parse_mix(argv[++i], opts.mix)) {
+                fprintf(stderr, "Error: Invalid traffic mix '%s'\n", argv[i]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.rate <= 0 || opts.users == 0 || opts.users > (1u << 18) || opts.channels == 0 || opts.probe_ms == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* ctx = nullptr;
+    if (!opts.cert.empty()) {
+        ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx || SSL_CTX_use_certificate_chain_file(ctx, opts.cert.c_str()) != 1
+            || SSL_CTX_use_PrivateKey_file(ctx, opts.key.c_str(), SSL_FILETYPE_PEM) != 1) {
+            fprintf(stderr, "Error loading TLS certificate %s and key %s\n", opts.cert.c_str(), opts.key.c_str());
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(opts.port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+        fprintf(stderr, "Error listening on 127.0.0.1:%u: %s\n", opts.port, strerror(errno));
+        return 1;
+    }
+    printf("Listening on 127.0.0.1:%u (%s%s%s)\n", opts.port, opts.p10 ? "P10" : "RFC 1459",
+           ctx ? ", TLS" : "", opts.websocket ? ", WebSocket" : "");
+    fflush(stdout);
+
+    Link link;
+    link.websocket = opts.websocket;
+    link.fd = accept(listener, nullptr, nullptr);
+    close(listener);
+    if (link.fd < 0) {
+        fprintf(stderr, "Error accepting: %s\n", strerror(errno));
+        return 1;
+    }
+    setsockopt(link.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(link.fd, F_SETFL, fcntl(link.fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if (ctx) {
+        link.ssl = SSL_new(ctx);
+        SSL_set_fd(link.ssl, link.fd);
+        int r;
+        while ((r = SSL_accept(link.ssl)) != 1) {
+            int err = SSL_get_error(link.ssl, r);
+            if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+                || !wait_for(link.fd, err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT)) {
+                fprintf(stderr, "TLS handshake failed\n");
+                ERR_print_errors_fp(stderr);
+                return 1;
+            }
+        }
+    }
+    if (opts.websocket && !websocket_handshake(link)) {
+        fprintf(stderr, "WebSocket handshake failed\n");
+        return 1;
+    }
+
+    LoadServer server(opts, link);
+    WsDecoder decoder;
+    char buf[65536];
+    bool open = true;
+    while (open && !stop && !server.Finished()) {
+        uint64_t now = now_ns();
+        server.Generate(now);
+        if (!link.Flush())
+            break;
+
+        struct pollfd pfd = { link.fd, static_cast<short>(POLLIN | (link.Backlog() ? POLLOUT : 0)), 0 };
+        int timeout = (link.ssl && SSL_pending(link.ssl) > 0) ? 0 : server.Timeout(now_ns());
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+            break;
+
+        // Drain what the client sent; TLS may hold records poll() cannot see.
+        for (int reads = 0; reads < 16; ++reads) {
+            ssize_t n = link.Read(buf, sizeof(buf));
+            if (n < 0) {
+                open = false;
+                break;
+            }
+            if (n == 0)
+                break;
+            link.in.append(buf, n);
+        }
+
+        if (!link.websocket) {
+            link.in.erase(0, for_each_irc_line(link.in, [&](const IrcMessage& msg) { server.OnLine(msg); }));
+            continue;
+        }
+        size_t offset = 0, consumed = 0;
+        for (;;) {
+            WsDecoder::Event event = decoder.Next(link.in.data() + offset, link.in.size() - offset, consumed);
+            offset += consumed;
+            if (event == WsDecoder::Event::Message) {
+                std::string_view payload = decoder.Payload();
+                if (!payload.empty() && payload.back() == '\n')
+                    payload.remove_suffix(1);
+                if (!payload.empty() && payload.back() == '\r')
+                    payload.remove_suffix(1);
+                IrcMessage msg;
+                if (parse_irc_message(payload, msg))
+                    server.OnLine(msg);
+            } else if (event == WsDecoder::Event::Close || event == WsDecoder::Event::Error) {
+                open = false;
+                break;
+            } else if (event == WsDecoder::Event::NeedMore) {
+                break;
+            }
+        }
+        link.in.erase(0, offset);
+    }
+
+    if (!server.Finished())
+        printf("Client disconnected\n");
+    if (link.ssl) {
+        SSL_shutdown(link.ssl);
+        SSL_free(link.ssl);
+    }
+    close(link.fd);
+    if (ctx)
+        SSL_CTX_free(ctx);
+    return server.Finished() ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+void Logger::setFlushPolicy(unsigned int interval_ms, size_t batch_bytes) {
+    flush_interval_ms = interval_ms > 0 ? interval_ms : 1;
+    flush_bytes = batch_bytes > 0 ? batch_bytes : 1;
+}
+
+void Logger::open(const std::string& filename) {
+    close();
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return;
+    stopping = false;
+    running = true;
+    writer = std::thread([this] { writerLoop(); });
+}
+
+void Logger::close() {
+    if (!running.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    ::close(fd);
+    fd = -1;
+}
+
+void Logger::log(const std::string& line) {
+    if (!running.load(std::memory_order_relaxed))
+        return;
+
+    char ts[TIMESTAMP_BUFFER_SIZE];
+    size_t ts_len = format_timestamp(ts, sizeof(ts), precision);
+
+    std::string entry;
+    entry.reserve(line.size() + ts_len + 4);
+    entry += '[';
+    entry.append(ts, ts_len);
+    entry += "] ";
+    entry += line;
+    entry += '\n';
+
+    // Counted before the push: the writer subtracts an entry as soon as it pops it, and must
+    // never see it before it is counted or the unsigned total would wrap.
+    size_t size = entry.size();
+    bool full = pending_bytes.fetch_add(size, std::memory_order_relaxed) + size >= flush_bytes;
+    queue.Push(std::move(entry));
+    // Notifying without the mutex may miss a sleeping writer; it then catches up on the next interval.
+    if (full)
+        wake.notify_one();
+}
+
+void Logger::writerLoop() {
+    std::string batch;
+    std::string entry;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(flush_interval_ms), [this] {
+                return stopping.load() || pending_bytes.load(std::memory_order_relaxed) >= flush_bytes;
+            });
+        }
+        bool stop = stopping.load();
+
+        while (queue.Pop(entry))
+            batch += entry;
+        pending_bytes.fetch_sub(batch.size(), std::memory_order_relaxed);
+        writeBatch(batch);
+        batch.clear();
+
+        if (stop)
+            return;
+    }
+}
+
+void Logger::writeBatch(const std::string& batch) {
+    size_t done = 0;
+    while (done < batch.size()) {
+        ssize_t n = ::write(fd, batch.data() + done, batch.size() - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return; // Nowhere to report it; drop the batch rather than stall producers.
+        }
+        done += static_cast<size_t>(n);
+    }
+}
@@ -23,6 +23,9 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "telnirc.h"
 #include "telnerv.h"
@@ -31,10 +34,44 @@
 
 volatile sig_atomic_t stop_program = 0;
 
+// Milliseconds the headless loop waits for input before it flushes output and checks stop_program.
+#define HEADLESS_POLL_MS 100
+
 void handle_signal(int) { stop_program = 1; }
 
 void handle_resize(int) { UIManager::resized = 1; }
 
+// Feeds commands to the module one line at a time. After end of input it keeps running until
+// the connection ends or a signal arrives.
+static void run_headless(Modules* module, UIManager& ui, int input_fd) {
+    std::string pending;
+    bool eof = false;
+    while (!stop_program) {
+        struct pollfd pfd = { eof ? -1 : input_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, HEADLESS_POLL_MS) > 0 && (pfd.revents & (POLLIN | POLLHUP))) {
+            char buf[4096];
+            ssize_t n = read(input_fd, buf, sizeof(buf));
+            if (n <= 0) {
+                eof = true;
+                pending += '\n';
+            } else {
+                pending.append(buf, n);
+            }
+            size_t start = 0, end;
+            while (!stop_program && (end = pending.find('\n', start)) != std::string::npos) {
+                std::string line = pending.substr(start, end - start);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (!line.empty())
+                    module->OnCommand(line);
+                start = end + 1;
+            }
+            pending.erase(0, start);
+        }
+        ui.flush();
+    }
+}
+
 int main(int argc, char *argv[]) {
     // Ignore SIGPIPE
     struct sigaction sa;
@@ -52,6 +89,11 @@ int main(int argc, char *argv[]) {
 
     bool hasMode = false;  // Ensure at least one of -s or -c is present
     char mode = '\0';      // Stores either 's' or 'c'
+    bool headless = false;
+    std::string scriptFile;
+    std::string outputFile;
+    std::string replayFile;
+    bool replayPaced = false;
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-f") == 0) {
@@ -76,6 +118,24 @@ int main(int argc, char *argv[]) {
             }
             mode = 'c';
             hasMode = true;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-o") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing argument for " << argv[i] << " option\n";
+                return 1;
+            }
+            (argv[i][1] == 'i' ? scriptFile : outputFile) = argv[i + 1];
+            ++i;
+        } else if (strcmp(argv[i], "-R") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing argument for -R option\n";
+                return 1;
+            }
+            replayFile = argv[i + 1];
+            ++i;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            replayPaced = true;
         } else {
             std::cerr << "Error: Unknown option '" << argv[i] << "'\n";
             return 1;
@@ -84,18 +144,47 @@ int main(int argc, char *argv[]) {
 
     // Ensure at least -s or -c is provided
     if (!hasMode) {
-        std::cerr   << "SYNTAX: " << argv[0] << " [-f file] -c | -s\n"
+        std::cerr   << "SYNTAX: " << argv[0] << " [-f file] [-H [-i script] [-o output]] [-R capture [-p]] -c | -s\n"
                     << "\t-f: Config file. Default: config.cfg\n"
                     << "\t-s: Spins up a server\n"
-                    << "\t-c: Spins up a client" << std::endl;
+                    << "\t-c: Spins up a client\n"
+                    << "\t-H: Headless: no ncurses, commands from stdin and output to stdout\n"
+                    << "\t-i: Headless command script instead of stdin\n"
+                    << "\t-o: Headless output file instead of stdout\n"
+                    << "\t-R: Replay a capture file instead of connecting, as fast as possible\n"
+                    << "\t-p: With -R, replay at the recorded pacing" << std::endl;
+        return 1;
+    }
+
+    if (!headless && (!scriptFile.empty() || !outputFile.empty())) {
+        std::cerr << "Error: -i and -o require -H\n";
+        return 1;
+    }
+
+    if (replayPaced && replayFile.empty()) {
+        std::cerr << "Error: -p requires -R\n";
+        return 1;
+    }
+
+    int input_fd = STDIN_FILENO;
+    int output_fd = STDOUT_FILENO;
+    if (!scriptFile.empty() && (input_fd = open(scriptFile.c_str(), O_RDONLY)) < 0) {
+        std::cerr << "Error opening " << scriptFile << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (!outputFile.empty() && (output_fd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+        std::cerr << "Error opening " << outputFile << ": " << strerror(errno) << "\n";
         return 1;
     }
 
     Modules* module = nullptr;
 
-    // Initialize ncurses
+    // Initialize ncurses, or the plain output sink when headless.
     UIManager ui;
-    ui.init();
+    if (headless)
+        ui.initHeadless(output_fd);
+    else
+        ui.init();
 
     switch (mode) {
         case 'c':
@@ -108,12 +197,18 @@ int main(int argc, char *argv[]) {
             return 1;
     }
 
+    module->replayFile = replayFile;
+    module->replayPaced = replayPaced;
+
     // Print banner.
     module->Banner();
 
     // Attach.
     module->Attach();
 
+    if (headless)
+        run_headless(module, ui, input_fd);
+
     std::string input_line;
     int cursor_x = 3;
     bool need_redraw_output = true;
@@ -146,6 +241,8 @@ int main(int argc, char *argv[]) {
             case KEY_NPAGE: ui.scrollPageDown(); need_redraw_output = true; break;
             case KEY_UP:    ui.scrollUp(); need_redraw_output = true; break;
             case KEY_DOWN:  ui.scrollDown(); need_redraw_output = true; break;
+            case 'N' & 0x1f: ui.nextBuffer(1); need_redraw_output = true; break;   // ^N
+            case 'P' & 0x1f: ui.nextBuffer(-1); need_redraw_output = true; break;  // ^P
             default:
                 break;
         }
@@ -167,5 +264,6 @@ int main(int argc, char *argv[]) {
     // Clean up.
     delete module; module = nullptr;
 
-    std::cout << "Program exiting ..." << std::endl;
+    if (!headless)
+        std::cout << "Program exiting ..." << std::endl;
 }
\ No newline at end of file
@@ -26,6 +26,8 @@
 #include <sys/types.h> // For uid_t
 #include <unistd.h>    // For getuid()
 #include <cwchar>
+#include <cstring>
+#include <algorithm>
 
 #include <openssl/evp.h>
 #include <openssl/rand.h>
@@ -72,11 +74,8 @@ bool parse_host(const std::string& host, unsigned int default_port, HostConfig&
 
     size_t slash = rest.find('/');
     std::string hostport = (slash != std::string::npos) ? rest.substr(0, slash) : rest;
-    if (slash != std::string::npos) {
-        out.path = rest.substr(slash);
-        if (out.path.empty())
-            out.path = "/";
-    }
+    if (slash != std::string::npos)
+        out.path = rest.substr(slash);  // Starts with the '/', so never empty.
 
     size_t colon = hostport.rfind(':');
     if (colon != std::string::npos) {
@@ -142,15 +141,72 @@ int utf8_display_width(const std::string& text) {
     return width;
 }
 
-std::string get_timestamp() {
-    auto now = std::time(nullptr);
-    auto tm = std::localtime(&now);
-    std::ostringstream oss;
-    oss << std::setfill('0')
-        << std::setw(2) << tm->tm_hour << ':'
-        << std::setw(2) << tm->tm_min << ':'
-        << std::setw(2) << tm->tm_sec;
-    return oss.str();
+static inline void put_digits(char* out, unsigned long value, int digits) {
+    for (int i = digits - 1; i >= 0; --i) {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+}
+
+size_t format_timestamp(char* buf, size_t size, TimestampPrecision precision) {
+    struct Cache {
+        time_t second = -1;
+        char hms[8];
+    };
+    thread_local Cache cache;
+
+    if (size == 0)
+        return 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if (ts.tv_sec != cache.second) {
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        put_digits(cache.hms, tm.tm_hour, 2);
+        cache.hms[2] = ':';
+        put_digits(cache.hms + 3, tm.tm_min, 2);
+        cache.hms[5] = ':';
+        put_digits(cache.hms + 6, tm.tm_sec, 2);
+        cache.second = ts.tv_sec;
+    }
+
+    char tmp[TIMESTAMP_BUFFER_SIZE];
+    size_t len = sizeof(cache.hms);
+    std::memcpy(tmp, cache.hms, len);
+    if (precision == TimestampPrecision::Millis) {
+        tmp[len++] = '.';
+        put_digits(tmp + len, ts.tv_nsec / 1000000, 3);
+        len += 3;
+    } else if (precision == TimestampPrecision::Micros) {
+        tmp[len++] = '.';
+        put_digits(tmp + len, ts.tv_nsec / 1000, 6);
+        len += 6;
+    }
+
+    len = std::min(len, size - 1);
+    std::memcpy(buf, tmp, len);
+    buf[len] = '\0';
+    return len;
+}
+
+std::string get_timestamp(TimestampPrecision precision) {
+    char buf[TIMESTAMP_BUFFER_SIZE];
+    size_t len = format_timestamp(buf, sizeof(buf), precision);
+    return std::string(buf, len);
+}
+
+bool parse_timestamp_precision(const std::string& value, TimestampPrecision& out) {
+    if (value == "s" || value.empty())
+        out = TimestampPrecision::Seconds;
+    else if (value == "ms")
+        out = TimestampPrecision::Millis;
+    else if (value == "us")
+        out = TimestampPrecision::Micros;
+    else
+        return false;
+    return true;
 }
 
 std::string generate_random_number_string(size_t length) {
@@ -185,4 +241,20 @@ std::string get_unix_username() {
     } else {
         return "unknown";
     }
-}
\ No newline at end of file
+}
+
+size_t irc_hash(std::string_view s) {
+    size_t h = 14695981039346656037ULL;
+    for (char c : s)
+        h = (h ^ static_cast<unsigned char>(irc_fold(c))) * 1099511628211ULL;
+    return h;
+}
+
+bool irc_equal(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (irc_fold(a[i]) != irc_fold(b[i]))
+            return false;
+    return true;
+}
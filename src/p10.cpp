@@ -0,0 +1,689 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <algorithm>
+#include <charconv>
+
+#include "misc.h"
+#include "numeric.h"
+#include "p10.h"
+
+const std::unordered_map<std::string_view, P10Network::Handler> P10Network::handlers = {
+    { "SERVER", &P10Network::handle_server },
+    { "S", &P10Network::handle_server },
+    { "N", &P10Network::handle_nick },
+    { "B", &P10Network::handle_burst },
+    { "J", &P10Network::handle_join },
+    { "C", &P10Network::handle_create },
+    { "L", &P10Network::handle_part },
+    { "K", &P10Network::handle_kick },
+    { "Q", &P10Network::handle_quit },
+    { "D", &P10Network::handle_kill },
+    { "SQ", &P10Network::handle_squit },
+    { "M", &P10Network::handle_mode },
+    { "OM", &P10Network::handle_mode },
+    { "AC", &P10Network::handle_account },
+};
+
+static std::string irc_lower(std::string_view s) {
+    std::string out(s);
+    for (char& c : out)
+        c = irc_fold(c);
+    return out;
+}
+
+static uint64_t mode_bit(char c) {
+    if (c >= 'a' && c <= 'z')
+        return uint64_t(1) << (c - 'a');
+    if (c >= 'A' && c <= 'Z')
+        return uint64_t(1) << (26 + c - 'A');
+    return 0;
+}
+
+static void apply_user_modes(uint64_t& modes, std::string_view change) {
+    bool add = true;
+    for (char c : change) {
+        if (c == '+' || c == '-')
+            add = (c == '+');
+        else if (add)
+            modes |= mode_bit(c);
+        else
+            modes &= ~mode_bit(c);
+    }
+}
+
+static time_t to_time(std::string_view s) {
+    long long v = 0;
+    std::from_chars(s.data(), s.data() + s.size(), v);
+    return static_cast<time_t>(v);
+}
+
+// Splits YYXXX (or the short YXX form) into server and client numerics.
+static bool split_numeric(std::string_view n, unsigned int& server, unsigned int& client) {
+    if (n.size() == 5) {
+        server = base64toint(n.data(), 2);
+        client = base64toint(n.data() + 2, 3);
+        return true;
+    }
+    if (n.size() == 3) {
+        server = base64toint(n.data(), 1);
+        client = base64toint(n.data() + 1, 2);
+        return true;
+    }
+    return false;
+}
+
+template <typename F>
+static void for_each_item(std::string_view list, char sep, F f) {
+    while (!list.empty()) {
+        size_t end = list.find(sep);
+        std::string_view item = list.substr(0, end);
+        list.remove_prefix(end == std::string_view::npos ? list.size() : end + 1);
+        if (!item.empty())
+            f(item);
+    }
+}
+
+P10Network::P10Network() : servers(P10_MAX_SERVERS) {
+    nick_table.assign(P10_USER_CHUNK, 0);
+    channel_names.reserve(P10_USER_CHUNK);
+}
+
+bool P10Network::Dispatch(const IrcMessage& msg) {
+    auto handler = handlers.find(msg.command);
+    if (handler == handlers.end())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    (this->*handler->second)(msg);
+    lines_applied.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool P10Network::LookupUser(std::string_view nick, P10User& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t slot = NickSlot(nick);
+    if (!slot)
+        return false;
+    out = UserAt(slot - 1);
+    return true;
+}
+
+bool P10Network::LookupChannel(std::string_view name, P10Channel& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t slot = ChannelSlot(name);
+    if (!slot)
+        return false;
+    out = channels[slot - 1];
+    return true;
+}
+
+std::string P10Network::ModeString(uint64_t modes) {
+    std::string out = "+";
+    for (char c = 'a'; c <= 'z'; ++c)
+        if (modes & mode_bit(c))
+            out += c;
+    for (char c = 'A'; c <= 'Z'; ++c)
+        if (modes & mode_bit(c))
+            out += c;
+    return out;
+}
+
+uint32_t P10Network::UserSlot(std::string_view numeric) const {
+    unsigned int server, client;
+    if (!split_numeric(numeric, server, client) || server >= P10_MAX_SERVERS || !servers[server].used)
+        return 0;
+    const P10Server& s = servers[server];
+    return s.clients[client & s.mask];
+}
+
+uint32_t P10Network::ChannelSlot(std::string_view name) const {
+    auto it = channel_names.find(irc_lower(name));
+    return it == channel_names.end() ? 0 : it->second + 1;
+}
+
+uint32_t P10Network::NickSlot(std::string_view nick) const {
+    size_t mask = nick_table.size() - 1;
+    for (size_t i = irc_hash(nick) & mask; nick_table[i]; i = (i + 1) & mask) {
+        if (irc_equal(UserAt(nick_table[i] - 1).nick, nick))
+            return nick_table[i];
+    }
+    return 0;
+}
+
+// A nick already in the table (a collision the servers will resolve) is pointed at the new user.
+void P10Network::NickInsert(uint32_t slot) {
+    if ((nick_count + 1) * 2 > nick_table.size())
+        NickGrow();
+    const std::string& nick = UserAt(slot).nick;
+    size_t mask = nick_table.size() - 1;
+    size_t i = irc_hash(nick) & mask;
+    for (; nick_table[i]; i = (i + 1) & mask) {
+        if (irc_equal(UserAt(nick_table[i] - 1).nick, nick)) {
+            nick_table[i] = slot + 1;
+            return;
+        }
+    }
+    nick_table[i] = slot + 1;
+    nick_count++;
+}
+
+// Removes the slot's entry and shifts later entries of the probe run back, so no tombstones are needed.
+void P10Network::NickErase(uint32_t slot) {
+    size_t mask = nick_table.size() - 1;
+    size_t i = irc_hash(UserAt(slot).nick) & mask;
+    while (nick_table[i] != slot + 1) {
+        if (!nick_table[i])
+            return;
+        i = (i + 1) & mask;
+    }
+
+    for (size_t j = (i + 1) & mask; nick_table[j]; j = (j + 1) & mask) {
+        size_t home = irc_hash(UserAt(nick_table[j] - 1).nick) & mask;
+        // Move j into the hole unless its home lies cyclically in (i, j].
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            nick_table[i] = nick_table[j];
+            i = j;
+        }
+    }
+    nick_table[i] = 0;
+    nick_count--;
+}
+
+void P10Network::NickGrow() {
+    std::vector<uint32_t> old(nick_table.size() * 2, 0);
+    old.swap(nick_table);
+    size_t mask = nick_table.size() - 1;
+    for (uint32_t entry : old) {
+        if (!entry)
+            continue;
+        size_t i = irc_hash(UserAt(entry - 1).nick) & mask;
+        while (nick_table[i])
+            i = (i + 1) & mask;
+        nick_table[i] = entry;
+    }
+}
+
+uint32_t P10Network::AddUser(unsigned int server, unsigned int client) {
+    uint32_t slot;
+    if (!free_users.empty()) {
+        slot = free_users.back();
+        free_users.pop_back();
+    } else {
+        slot = users_allocated++;
+        if (slot % P10_USER_CHUNK == 0)
+            user_chunks.emplace_back(new P10User[P10_USER_CHUNK]);
+    }
+
+    P10Server& s = servers[server];
+    uint32_t& entry = s.clients[client & s.mask];
+    if (entry)
+        RemoveUser(entry - 1); // Numeric reused without a QUIT; drop the stale user.
+    entry = slot + 1;
+    s.userCount++;
+
+    P10User& u = UserAt(slot);
+    u.used = true;
+    u.channels.reserve(4);
+    u.numeric = (server << P10_CLIENT_BITS) | (client & s.mask);
+    users_online.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+void P10Network::RemoveUser(uint32_t slot) {
+    P10User& u = UserAt(slot);
+    if (!u.used)
+        return;
+
+    while (!u.channels.empty())
+        RemoveMember(u.channels.back(), slot);
+
+    NickErase(slot);
+
+    P10Server& s = servers[u.numeric >> P10_CLIENT_BITS];
+    s.clients[u.numeric & s.mask] = 0;
+    s.userCount--;
+
+    u = P10User();
+    free_users.push_back(slot);
+    users_online.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void P10Network::RemoveServer(unsigned int numeric) {
+    P10Server& s = servers[numeric];
+    if (!s.used)
+        return;
+
+    for (unsigned int i = 0; i < P10_MAX_SERVERS; ++i) {
+        if (i != numeric && servers[i].used && servers[i].uplink == numeric)
+            RemoveServer(i);
+    }
+
+    for (uint32_t entry : s.clients) {
+        if (entry)
+            RemoveUser(entry - 1);
+    }
+
+    server_names.erase(irc_lower(s.name));
+    s = P10Server();
+    servers_linked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint32_t P10Network::GetChannel(std::string_view name, time_t ts) {
+    std::string key = irc_lower(name);
+    auto it = channel_names.find(key);
+    if (it != channel_names.end()) {
+        P10Channel& c = channels[it->second];
+        if (ts > 0 && (c.ts == 0 || ts < c.ts))
+            c.ts = ts;
+        return it->second;
+    }
+
+    uint32_t slot;
+    if (!free_channels.empty()) {
+        slot = free_channels.back();
+        free_channels.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(channels.size());
+        channels.emplace_back();
+    }
+    P10Channel& c = channels[slot];
+    c.used = true;
+    c.name = name;
+    c.ts = ts;
+    channel_names.emplace(std::move(key), slot);
+    channels_live.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+void P10Network::AddMember(uint32_t chan, uint32_t user, uint32_t flags) {
+    P10Channel& c = channels[chan];
+    P10User& u = UserAt(user);
+    if (std::find(u.channels.begin(), u.channels.end(), chan) != u.channels.end()) {
+        SetMemberFlags(chan, user, flags, true);
+        return;
+    }
+    c.members.push_back((user << P10_MEMBER_FLAGS) | flags);
+    u.channels.push_back(chan);
+    memberships.fetch_add(1, std::memory_order_relaxed);
+}
+
+void P10Network::RemoveMember(uint32_t chan, uint32_t user) {
+    P10User& u = UserAt(user);
+    auto uc = std::find(u.channels.begin(), u.channels.end(), chan);
+    if (uc == u.channels.end())
+        return;
+    *uc = u.channels.back();
+    u.channels.pop_back();
+
+    P10Channel& c = channels[chan];
+    for (auto& m : c.members) {
+        if ((m >> P10_MEMBER_FLAGS) == user) {
+            m = c.members.back();
+            c.members.pop_back();
+            break;
+        }
+    }
+    memberships.fetch_sub(1, std::memory_order_relaxed);
+
+    if (c.members.empty()) {
+        channel_names.erase(irc_lower(c.name));
+        c = P10Channel();
+        free_channels.push_back(chan);
+        channels_live.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void P10Network::SetMemberFlags(uint32_t chan, uint32_t user, uint32_t flags, bool add) {
+    for (auto& m : channels[chan].members) {
+        if ((m >> P10_MEMBER_FLAGS) == user) {
+            m = add ? (m | flags) : (m & ~flags);
+            return;
+        }
+    }
+}
+
+// Applies a mode string at params[first] and its arguments; returns the index of the first unused param.
+size_t P10Network::ApplyChannelModes(uint32_t chan, const IrcMessage& msg, size_t first) {
+    std::string_view change = msg.param(first);
+    size_t arg = first + 1;
+    bool add = true;
+
+    for (char c : change) {
+        switch (c) {
+        case '+':
+        case '-':
+            add = (c == '+');
+            break;
+        case 'o':
+        case 'v': {
+            uint32_t user = UserSlot(msg.param(arg++));
+            if (user)
+                SetMemberFlags(chan, user - 1, c == 'o' ? P10_MEMBER_OP : P10_MEMBER_VOICE, add);
+            break;
+        }
+        case 'b': {
+            std::string_view mask = msg.param(arg++);
+            auto& bans = channels[chan].bans;
+            if (add)
+                bans.emplace_back(mask);
+            else
+                bans.erase(std::remove(bans.begin(), bans.end(), mask), bans.end());
+            break;
+        }
+        case 'k':
+            channels[chan].key = add ? std::string(msg.param(arg)) : std::string();
+            arg++;
+            channels[chan].modes = add ? (channels[chan].modes | mode_bit(c)) : (channels[chan].modes & ~mode_bit(c));
+            break;
+        case 'l':
+            if (add) {
+                channels[chan].limit = static_cast<unsigned int>(to_time(msg.param(arg++)));
+                channels[chan].modes |= mode_bit(c);
+            } else {
+                channels[chan].limit = 0;
+                channels[chan].modes &= ~mode_bit(c);
+            }
+            break;
+        case 'A':
+        case 'U':
+            arg++; // Undernet apass/upass: argument only, not tracked.
+            break;
+        default:
+            channels[chan].modes = add ? (channels[chan].modes | mode_bit(c)) : (channels[chan].modes & ~mode_bit(c));
+            break;
+        }
+    }
+    return arg;
+}
+
+// SERVER <name> <hop> <start> <link> <proto> <YYMMM> [+flags] :<description>
+// <YY> S <name> <hop> <start> <link> <proto> <YYMMM> [+flags] :<description>
+void P10Network::handle_server(const IrcMessage& msg) {
+    std::string_view numeric = msg.param(5);
+    unsigned int yy, capacity;
+    if (!split_numeric(numeric, yy, capacity) || yy >= P10_MAX_SERVERS)
+        return;
+
+    RemoveServer(yy);
+
+    // The client table is sized to the advertised capacity, rounded up to a power of two.
+    unsigned int mask = 1;
+    while (mask < capacity)
+        mask = (mask << 1) | 1;
+
+    P10Server& s = servers[yy];
+    s.used = true;
+    s.name = msg.param(0);
+    s.uplink = msg.source.empty() ? yy : base64toint(msg.source.data(), msg.source.size());
+    s.mask = mask;
+    s.clients.assign(static_cast<size_t>(mask) + 1, 0);
+    s.userCount = 0;
+    server_names[irc_lower(s.name)] = yy;
+    servers_linked.fetch_add(1, std::memory_order_relaxed);
+}
+
+// <YY> N <nick> <hop> <ts> <user> <host> [+modes [args]] <ip> <YYXXX> :<realname>
+// <YYXXX> N <newnick> <ts>
+void P10Network::handle_nick(const IrcMessage& msg) {
+    if (msg.source.size() > 2) {
+        uint32_t slot = UserSlot(msg.source);
+        if (!slot)
+            return;
+        P10User& u = UserAt(slot - 1);
+        NickErase(slot - 1);
+        u.nick = msg.param(0);
+        u.ts = to_time(msg.param(1));
+        NickInsert(slot - 1);
+        return;
+    }
+
+    if (msg.param_count < 8)
+        return;
+    size_t last = msg.param_count - 1;
+    unsigned int server, client;
+    if (!split_numeric(msg.params[last - 1], server, client) || server >= P10_MAX_SERVERS || !servers[server].used)
+        return;
+
+    uint32_t slot = AddUser(server, client);
+    P10User& u = UserAt(slot);
+    u.nick = msg.params[0];
+    u.ts = to_time(msg.params[2]);
+    u.user = msg.params[3];
+    u.host = msg.params[4];
+    u.ip = msg.params[last - 2];
+    u.realname = msg.params[last];
+
+    if (msg.params[5].size() > 0 && msg.params[5][0] == '+') {
+        apply_user_modes(u.modes, msg.params[5]);
+        // Mode arguments sit between the mode string and the IP, in mode letter order.
+        size_t arg = 6;
+        for (char c : msg.params[5]) {
+            if ((c == 'r' || c == 'h') && arg < last - 2) {
+                if (c == 'r')
+                    u.account = msg.params[arg].substr(0, msg.params[arg].find(':'));
+                arg++;
+            }
+        }
+    }
+
+    NickInsert(slot);
+}
+
+// <YY> B <#chan> <ts> [+modes [args]] [<members>] [:%<bans>]
+void P10Network::handle_burst(const IrcMessage& msg) {
+    if (msg.param_count < 2)
+        return;
+    uint32_t chan = GetChannel(msg.params[0], to_time(msg.params[1]));
+
+    size_t i = 2;
+    if (i < msg.param_count && msg.params[i].size() > 0 && msg.params[i][0] == '+')
+        i = ApplyChannelModes(chan, msg, i);
+
+    for (; i < msg.param_count; ++i) {
+        std::string_view param = msg.params[i];
+        if (!param.empty() && param[0] == '%') {
+            for_each_item(param.substr(1), ' ', [&](std::string_view mask) { channels[chan].bans.emplace_back(mask); });
+            continue;
+        }
+
+        // Member modes carry over to the following entries until the next ':' suffix.
+        uint32_t flags = 0;
+        for_each_item(param, ',', [&](std::string_view entry) {
+            size_t colon = entry.find(':');
+            if (colon != std::string_view::npos) {
+                flags = 0;
+                for (char c : entry.substr(colon + 1)) {
+                    if (c == 'o' || (c >= '0' && c <= '9'))
+                        flags |= P10_MEMBER_OP;
+                    else if (c == 'v')
+                        flags |= P10_MEMBER_VOICE;
+                }
+                entry = entry.substr(0, colon);
+            }
+            uint32_t user = UserSlot(entry);
+            if (user)
+                AddMember(chan, user - 1, flags);
+        });
+    }
+}
+
+// <YYXXX> J <#chan>[,<#chan>] [ts]; "J 0" parts every channel.
+void P10Network::handle_join(const IrcMessage& msg) {
+    uint32_t user = UserSlot(msg.source);
+    if (!user)
+        return;
+    if (msg.param(0) == "0") {
+        while (!UserAt(user - 1).channels.empty())
+            RemoveMember(UserAt(user - 1).channels.back(), user - 1);
+        return;
+    }
+    time_t ts = to_time(msg.param(1));
+    for_each_item(msg.param(0), ',', [&](std::string_view name) { AddMember(GetChannel(name, ts), user - 1, 0); });
+}
+
+// <YYXXX> C <#chan>[,<#chan>] <ts>: creates the channels with the source opped.
+void P10Network::handle_create(const IrcMessage& msg) {
+    uint32_t user = UserSlot(msg.source);
+    if (!user)
+        return;
+    time_t ts = to_time(msg.param(1));
+    for_each_item(msg.param(0), ',', [&](std::string_view name) {
+        AddMember(GetChannel(name, ts), user - 1, P10_MEMBER_OP);
+    });
+}
+
+// <YYXXX> L <#chan>[,<#chan>] [:reason]
+void P10Network::handle_part(const IrcMessage& msg) {
+    uint32_t user = UserSlot(msg.source);
+    if (!user)
+        return;
+    for_each_item(msg.param(0), ',', [&](std::string_view name) {
+        uint32_t chan = ChannelSlot(name);
+        if (chan)
+            RemoveMember(chan - 1, user - 1);
+    });
+}
+
+// <source> K <#chan> <YYXXX> :reason
+void P10Network::handle_kick(const IrcMessage& msg) {
+    uint32_t chan = ChannelSlot(msg.param(0));
+    uint32_t user = UserSlot(msg.param(1));
+    if (chan && user)
+        RemoveMember(chan - 1, user - 1);
+}
+
+// <YYXXX> Q :reason
+void P10Network::handle_quit(const IrcMessage& msg) {
+    uint32_t user = UserSlot(msg.source);
+    if (user)
+        RemoveUser(user - 1);
+}
+
+// <source> D <YYXXX> :path (reason)
+void P10Network::handle_kill(const IrcMessage& msg) {
+    uint32_t user = UserSlot(msg.param(0));
+    if (user)
+        RemoveUser(user - 1);
+}
+
+// <source> SQ <server name> <ts> :reason; drops the server, everything behind it and their users.
+void P10Network::handle_squit(const IrcMessage& msg) {
+    auto it = server_names.find(irc_lower(msg.param(0)));
+    if (it != server_names.end())
+        RemoveServer(it->second);
+}
+
+// <source> M|OM <#chan> <modes> [args] [ts]  or  <YYXXX> M <nick> :<modes>
+void P10Network::handle_mode(const IrcMessage& msg) {
+    std::string_view target = msg.param(0);
+    if (target.empty())
+        return;
+    if (target[0] == '#' || target[0] == '&') {
+        uint32_t chan = ChannelSlot(target);
+        if (chan)
+            ApplyChannelModes(chan - 1, msg, 1);
+        return;
+    }
+    uint32_t user = NickSlot(target);
+    if (user)
+        apply_user_modes(UserAt(user - 1).modes, msg.param(1));
+}
+
+// <YY> AC <YYXXX> <account> [ts]  or  <YY> AC <YYXXX> R|M|U [account] [ts]
+void P10Network::handle_account(const IrcMessage& msg) {
+    uint32_t user = UserSlot(msg.param(0));
+    if (!user)
+        return;
+    std::string_view sub = msg.param(1);
+    if (sub == "U")
+        UserAt(user - 1).account.clear();
+    else if (sub == "R" || sub == "M")
+        UserAt(user - 1).account = msg.param(2);
+    else
+        UserAt(user - 1).account = sub;
+}
+
+size_t p10_channel_burst(std::string& out, std::string_view source, std::string_view channel, time_t ts,
+                         std::string_view modes, const std::vector<uint32_t>& members,
+                         const std::vector<std::string>& bans) {
+    // Member groups in burst order, one pass over members each.
+    static const uint32_t group[4] = { 0, P10_MEMBER_VOICE, P10_MEMBER_OP, P10_MEMBER_OP | P10_MEMBER_VOICE };
+    static const std::string_view suffix[4] = { "", ":v", ":o", ":ov" };
+
+    char tsbuf[24];
+    std::string_view tsv(tsbuf, std::to_chars(tsbuf, tsbuf + sizeof(tsbuf), static_cast<long long>(ts)).ptr - tsbuf);
+
+    size_t lines = 0;
+    size_t start = 0;           // Offset of the current line in out.
+    bool content = false;       // The current line carries members or bans.
+    unsigned int rank = 0;      // Member group in effect on the current line.
+    bool banlist = false;       // The current line has opened its ":%" list.
+    auto begin_line = [&](bool first) {
+        start = out.size();
+        out += source;
+        out += " B ";
+        out += channel;
+        out += ' ';
+        out += tsv;
+        if (first && !modes.empty()) {
+            out += ' ';
+            out += modes;
+        }
+        content = banlist = false;
+        rank = 0;
+        lines++;
+    };
+
+    begin_line(true);
+    char numeric[6];
+    for (unsigned int r = 0; r < 4; ++r) {
+        for (uint32_t member : members) {
+            if ((member & ((1u << P10_MEMBER_FLAGS) - 1)) != group[r])
+                continue;
+            uint32_t full = member >> P10_MEMBER_FLAGS;
+            inttobase64(numeric, full >> P10_CLIENT_BITS, 2);
+            inttobase64(numeric + 2, full & ((1u << P10_CLIENT_BITS) - 1), 3);
+
+            size_t need = 6 + (r != rank ? suffix[r].size() : 0);
+            if (content && out.size() - start + need > P10_MAX_LINE) {
+                out += "\r\n";
+                begin_line(false);
+            }
+            out += content ? ',' : ' ';
+            out.append(numeric, 5);
+            if (r != rank)
+                out += suffix[r];
+            rank = r;
+            content = true;
+        }
+    }
+
+    for (const std::string& ban : bans) {
+        size_t need = (banlist ? 1 : 3) + ban.size();
+        if (content && out.size() - start + need > P10_MAX_LINE) {
+            out += "\r\n";
+            begin_line(false);
+        }
+        out += banlist ? " " : " :%";
+        out += ban;
+        banlist = content = true;
+    }
+    out += "\r\n";
+    return lines;
+}
@@ -0,0 +1,153 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "scrollback.h"
+
+Scrollback::Scrollback(size_t lines)
+    : max_lines(std::max<size_t>(lines, 1)),
+      entries(std::min<size_t>(max_lines, SCROLLBACK_INITIAL_LINES)),
+      arena(entries.size() * SCROLLBACK_BYTES_PER_LINE) {
+    rows.Assign(entries.size());
+}
+
+void Scrollback::Resize(size_t lines) {
+    Scrollback resized(lines);
+    resized.SetWrapWidth(wrap_width);
+    size_t keep = std::min(count, resized.Capacity());
+    for (size_t i = count - keep; i < count; ++i)
+        resized.Append(Text(i), Color(i));
+    *this = std::move(resized);
+}
+
+int Scrollback::RowCount(size_t length, int width) {
+    if (width <= 0)
+        return 0;
+    return static_cast<int>((length + width - 1) / width);
+}
+
+std::string_view Scrollback::Text(size_t i) const {
+    const Entry& entry = entries[Slot(i)];
+    return std::string_view(arena.data() + entry.offset, entry.length);
+}
+
+void Scrollback::EvictOldest() {
+    Entry& entry = entries[first];
+    rows.Add(first, -entry.rows);
+    entry = Entry();
+    first = (first + 1) % entries.size();
+    count--;
+}
+
+void Scrollback::Grow() {
+    size_t lines = std::min(max_lines, entries.size() * 2);
+    std::vector<Entry> grown(lines);
+    std::vector<char> grown_arena(lines * SCROLLBACK_BYTES_PER_LINE);
+    size_t tail = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Entry entry = entries[Slot(i)];
+        std::memcpy(grown_arena.data() + tail, arena.data() + entry.offset, entry.length);
+        entry.offset = static_cast<uint32_t>(tail);
+        tail += std::max<size_t>(entry.length, 1);
+        grown[i] = entry;
+    }
+    entries.swap(grown);
+    arena.swap(grown_arena);
+    first = 0;
+    arena_tail = tail;
+    rows.Assign(lines);
+    for (size_t i = 0; i < count; ++i)
+        rows.Add(i, entries[i].rows);
+}
+
+void Scrollback::Append(std::string_view text, int color) {
+    text = text.substr(0, max_lines * SCROLLBACK_BYTES_PER_LINE);
+    size_t len = text.size();
+    // Empty lines still take one byte so every line owns a distinct spot in the arena.
+    size_t reserve = std::max<size_t>(len, 1);
+
+    if (count == entries.size()) {
+        if (entries.size() < max_lines)
+            Grow();
+        else
+            EvictOldest();
+    }
+    while (reserve > arena.size())
+        Grow();
+
+    // Live text always sits in the circular range [oldest offset, arena_tail): find `reserve`
+    // free bytes right after the tail, wrapping to the start of the arena (and wasting its end)
+    // when needed, and evicting the oldest lines until they fit.
+    for (;;) {
+        if (count == 0) {
+            arena_tail = 0;
+            break;
+        }
+        size_t head = entries[first].offset;
+        if (head < arena_tail) {
+            if (arena_tail + reserve <= arena.size())
+                break;
+            arena_tail = 0;
+            continue;
+        }
+        if (arena_tail + reserve <= head)
+            break;
+        if (entries.size() < max_lines)
+            Grow();
+        else
+            EvictOldest();
+    }
+
+    size_t slot = Slot(count);
+    Entry& entry = entries[slot];
+    entry.offset = static_cast<uint32_t>(arena_tail);
+    entry.length = static_cast<uint32_t>(len);
+    entry.color = color;
+    entry.rows = RowCount(len, wrap_width);
+    if (len > 0)
+        std::memcpy(arena.data() + arena_tail, text.data(), len);
+    arena_tail += reserve;
+    count++;
+    rows.Add(slot, entry.rows);
+}
+
+// Recomputes every line's row count; only needed when the window width changes.
+void Scrollback::SetWrapWidth(int width) {
+    wrap_width = width;
+    rows.Assign(entries.size());
+    for (size_t i = 0; i < count; ++i) {
+        Entry& entry = entries[Slot(i)];
+        entry.rows = RowCount(entry.length, wrap_width);
+        rows.Add(Slot(i), entry.rows);
+    }
+}
+
+size_t Scrollback::FindRow(long row, long& offset) const {
+    offset = 0;
+    if (row < 0 || row >= rows.Total())
+        return count;
+
+    // Logical order is slots [first, capacity) followed by [0, first).
+    long before_first = rows.Prefix(first);
+    long tail_rows = rows.Total() - before_first;
+    size_t slot = (row < tail_rows) ? rows.Find(before_first + row) : rows.Find(row - tail_rows);
+    offset = row - ((slot >= first) ? rows.Prefix(slot) - before_first : tail_rows + rows.Prefix(slot));
+    return (slot + entries.size() - first) % entries.size();
+}
@@ -0,0 +1,105 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <algorithm>
+#include <cstdio>
+
+#include "stats.h"
+
+uint64_t LatencyHistogram::ValueOf(size_t bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+    uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return low + ((uint64_t(1) << shift) >> 1);
+}
+
+LatencyHistogram::Summary LatencyHistogram::Summarize() const {
+    Summary s;
+    // Buckets are read one by one while the writer keeps going; take the total from them
+    // so that the percentiles stay consistent with each other.
+    std::array<uint64_t, BUCKETS> snapshot;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        s.count += snapshot[i];
+    }
+    if (s.count == 0)
+        return s;
+
+    uint64_t recorded = count.load(std::memory_order_relaxed);
+    s.mean = recorded ? static_cast<double>(sum.load(std::memory_order_relaxed)) / recorded : 0;
+    s.max = max.load(std::memory_order_relaxed);
+
+    const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t* results[] = { &s.p50, &s.p90, &s.p99, &s.p999 };
+    size_t q = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS && q < 4; ++i) {
+        seen += snapshot[i];
+        while (q < 4 && seen >= quantiles[q] * s.count) {
+            *results[q] = std::min(ValueOf(i), s.max);
+            ++q;
+        }
+    }
+    return s;
+}
+
+static std::string format_ns(double ns) {
+    char buf[32];
+    if (ns < 1e3)
+        snprintf(buf, sizeof(buf), "%.0fns", ns);
+    else if (ns < 1e6)
+        snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else if (ns < 1e9)
+        snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    return buf;
+}
+
+void ConnStats::Format(std::vector<std::string>& out) const {
+    static const char* names[STAGE_COUNT] = { "read->parse", "parse->print", "send->write", "tls read", "ws decode" };
+    char line[256];
+
+    snprintf(line, sizeof(line), "%-13s %10s %9s %9s %9s %9s %9s %9s",
+             "stage", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    out.push_back(line);
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        LatencyHistogram::Summary s = stage[i].Summarize();
+        if (s.count == 0)
+            continue;
+        snprintf(line, sizeof(line), "%-13s %10llu %9s %9s %9s %9s %9s %9s", names[i],
+                 static_cast<unsigned long long>(s.count), format_ns(s.mean).c_str(), format_ns(s.p50).c_str(),
+                 format_ns(s.p90).c_str(), format_ns(s.p99).c_str(), format_ns(s.p999).c_str(),
+                 format_ns(s.max).c_str());
+        out.push_back(line);
+    }
+
+    auto get = [](const std::atomic<uint64_t>& c) { return static_cast<unsigned long long>(c.load(std::memory_order_relaxed)); };
+    unsigned long long reads = get(read_calls), writes = get(write_calls);
+    snprintf(line, sizeof(line), "in: %llu bytes, %llu lines, %llu read calls (%.0f bytes/call), %llu polls",
+             get(bytes_in), get(lines_in), reads, reads ? static_cast<double>(get(bytes_in)) / reads : 0.0, get(poll_calls));
+    out.push_back(line);
+    snprintf(line, sizeof(line), "out: %llu bytes, %llu entries, %llu write calls (%.0f bytes/call)",
+             get(bytes_out), get(entries_out), writes, writes ? static_cast<double>(get(bytes_out)) / writes : 0.0);
+    out.push_back(line);
+    snprintf(line, sizeof(line), "queues: send %lld (max %llu), write %llu entries, receive buffer %llu bytes",
+             static_cast<long long>(send_queue.load(std::memory_order_relaxed)), get(send_queue_max),
+             get(write_queue), get(recv_buffered));
+    out.push_back(line);
+}
@@ -16,6 +16,11 @@
  * USA.
  */
 
+#include <charconv>
+#include <cmath>
+#include <iomanip>
+#include <arpa/inet.h>
+
 #include "config.h"
 #include "misc.h"
 #include "connection.h"
@@ -47,6 +52,57 @@ telnERV::telnERV(const std::string& configFile, UIManager& ui)
     clientKeyFile = config.get<std::string>("tls_keyfile", "");
     if (clientKeyFile.empty())
         clientKeyFile = config.get<std::string>("tls_key", "");
+    recvBufferSize = config.get<size_t>("recv_buffer", DEFAULT_RECV_BUFFER);
+    captureFile = config.get<std::string>("capture", "");
+    statsFile = config.get<std::string>("stats_file", "");
+    statsInterval = config.get<unsigned int>("stats_interval", DEFAULT_STATS_INTERVAL);
+    wsDeflate.enabled = config.get<bool>("ws_deflate", false);
+    wsDeflate.client_no_context_takeover = config.get<bool>("ws_deflate_client_no_context_takeover", false);
+    wsDeflate.server_no_context_takeover = config.get<bool>("ws_deflate_server_no_context_takeover", false);
+    wsDeflate.client_max_window_bits = config.get<int>("ws_deflate_client_window_bits", WS_DEFLATE_MAX_WINDOW_BITS);
+    wsDeflate.server_max_window_bits = config.get<int>("ws_deflate_server_window_bits", WS_DEFLATE_MAX_WINDOW_BITS);
+    if (wsDeflate.client_max_window_bits < WS_DEFLATE_MIN_WINDOW_BITS || wsDeflate.client_max_window_bits > WS_DEFLATE_MAX_WINDOW_BITS
+        || wsDeflate.server_max_window_bits < 8 || wsDeflate.server_max_window_bits > WS_DEFLATE_MAX_WINDOW_BITS)
+        ui.fatal("Invalid ws_deflate window bits (client 9-15, server 8-15).");
+    ui.setScrollback(config.get<size_t>("scrollback", DEFAULT_SCROLLBACK_LINES));
+
+    burstNick.assign(config.get<std::string>("burst_nick", "telnerv%d"));
+    burstUser.assign(config.get<std::string>("burst_user", "user%d"));
+    burstHost.assign(config.get<std::string>("burst_host", "host%d.telnerv.undernet.org"));
+    burstRealname = config.get<std::string>("burst_realname", "telnERV client");
+    burstModes = config.get<std::string>("burst_modes", "+i");
+    std::string ip = config.get<std::string>("burst_ip", "10.0.0.1");
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+        ui.fatal("Invalid burst_ip: " + ip);
+    burstIP = ntohl(addr.s_addr);
+    burstAtLink = config.get<unsigned int>("burst_clients", 0);
+    maxClients = config.get<unsigned int>("max_clients", MAX_SERVER_CLIENTS);
+    if (maxClients == 0 || maxClients > MAX_SERVER_CLIENTS)
+        ui.fatal("max_clients must be between 1 and " + std::to_string(MAX_SERVER_CLIENTS) + ".");
+    numerics.Reset(maxClients);
+    ownNicks.resize(maxClients);
+    if (!burstNick.numbered)
+        ui.fatal("burst_nick must contain %d.");
+
+    trafficRate = config.get<double>("traffic_rate", 0);
+    trafficPoisson = config.get<std::string>("traffic_distribution", "poisson") != "fixed";
+    trafficTick = config.get<unsigned int>("traffic_tick_ms", DEFAULT_TRAFFIC_TICK);
+    if (trafficTick == 0)
+        ui.fatal("traffic_tick_ms must be at least 1.");
+    if (!parseTrafficMix(config.get<std::string>("traffic_mix", "privmsg:70,join:10,part:10,nick:5,mode:5")))
+        ui.fatal("Invalid traffic_mix, expected e.g. privmsg:70,join:10,part:10,nick:5,mode:5");
+    trafficChannel.assign(config.get<std::string>("traffic_channel", "#load%d"));
+    unsigned int channels = config.get<unsigned int>("traffic_channels", 100);
+    if (!trafficChannel.numbered || channels == 0)
+        ui.fatal("traffic_channel must contain %d and traffic_channels must be at least 1.");
+    trafficMessage = config.get<std::string>("traffic_message", "The quick brown fox jumps over the lazy dog");
+    trafficWheel.Reset(maxClients, 0);
+    trafficDue.resize(maxClients);
+    trafficJoined.resize(maxClients);
+    trafficWallops.resize(maxClients);
+    trafficMembers.resize(channels);
+    trafficRng.seed(std::random_device{}());
 }
 
 telnERV::~telnERV() {
@@ -60,13 +116,25 @@ void telnERV::Attach() {
     ui.print(NC_YELLOW) << "My YY: " << serverYY << std::endl;
 
     // Initiate connection.
-    conn = new ConnectionManager(this, ui, logger, host,
-        use_tls, caCertFile, clientCertFile, clientKeyFile);
+    if (!replayFile.empty())
+        conn = new ConnectionManager(this, ui, logger, replayFile, replayPaced, recvBufferSize);
+    else
+        conn = new ConnectionManager(this, ui, logger, host,
+            use_tls, caCertFile, clientCertFile, clientKeyFile, recvBufferSize, wsDeflate, captureFile);
+    if (!statsFile.empty())
+        conn->SetStatsDump(statsFile, statsInterval);
 
     conn->Start();
 
     conn->SendData("PASS :" + password);
-    conn->SendData("SERVER " + serverName + " 0 " + std::to_string(time(nullptr)) + " " + std::to_string(time(nullptr)) + " J10 " + serverYY + "]]] + :telnERV");
+    // The XXX part of our numeric advertises the highest client numeric we will use.
+    char capacity[4];
+    inttobase64(capacity, maxClients - 1, 3);
+    conn->SendData("SERVER " + serverName + " 0 " + std::to_string(time(nullptr)) + " " + std::to_string(time(nullptr)) + " J10 " + serverYY + capacity + " + :telnERV");
+
+    // Our burst may follow SERVER right away; EB is only sent once the uplink's EB arrives.
+    if (burstAtLink > 0)
+        massBurst(burstAtLink, burstModes);
 }
 
 void telnERV::Detach() {
@@ -74,6 +142,9 @@ void telnERV::Detach() {
 }
 
 void telnERV::OnCommand(std::string input) {
+    if (input.empty())
+        return;
+
     if (input == "/h") {
         show_help();
     } else if (input.rfind("/n ", 0) == 0) {
@@ -82,6 +153,65 @@ void telnERV::OnCommand(std::string input) {
             burstClient(params[0], params[1], params[2], params[3]);
         else if( params.size() > 2)
             burstClient(params[0], params[1], params[2]);                
+    } else if (input.rfind("/burst ", 0) == 0) {
+        Params params = Tokenizer(input.substr(7));
+        unsigned long count = 0;
+        try {
+            count = params.empty() ? 0 : std::stoul(params[0]);
+        } catch (...) { }
+        if (count == 0)
+            ui.print(NC_RED) << "Usage: /burst <count> [modes]" << std::endl;
+        else
+            massBurst(static_cast<unsigned int>(std::min<unsigned long>(count, MAX_SERVER_CLIENTS)),
+                      params.size() > 1 ? params[1] : burstModes);
+    } else if (input.rfind("/cburst ", 0) == 0) {
+        Params params = Tokenizer(input.substr(8));
+        unsigned long numbers[4] = { 0, 0, 0, 0 };
+        bool valid = params.size() >= 2 && (params[0][0] == '#' || params[0][0] == '&');
+        for (size_t i = 1; valid && i < params.size() && i < 5; ++i) {
+            try {
+                numbers[i - 1] = std::stoul(params[i]);
+            } catch (...) {
+                valid = false;
+            }
+        }
+        std::string modes;
+        for (size_t i = 5; i < params.size(); ++i)
+            modes += (modes.empty() ? "" : " ") + params[i];
+        if (!valid || numbers[0] == 0 || numbers[1] > 100 || numbers[2] > 100)
+            ui.print(NC_RED) << "Usage: /cburst <#channel> <members> [op%] [voice%] [bans] [+modes [args]]" << std::endl;
+        else
+            channelBurst(params[0], static_cast<unsigned int>(numbers[0]), numbers[1], numbers[2],
+                         static_cast<unsigned int>(numbers[3]), modes);
+    } else if (input.rfind("/quit ", 0) == 0) {
+        Params params = Tokenizer(input.substr(6));
+        size_t reason = input.find(' ', 6);
+        if (!params.empty())
+            quitClient(params[0], reason != std::string::npos ? input.substr(reason + 1) : "Leaving");
+    } else if (input == "/traffic" || input.rfind("/traffic ", 0) == 0) {
+        Params params = Tokenizer(input.size() > 9 ? input.substr(9) : "");
+        double rate = 0;
+        try {
+            rate = params.empty() ? 0 : std::stod(params[0]);
+        } catch (...) { }
+        if (!params.empty() && params[0] == "off")
+            stopTraffic();
+        else if (rate <= 0 || (params.size() > 1 && params[1] != "poisson" && params[1] != "fixed"))
+            ui.print(NC_RED) << "Usage: /traffic <events/s> [poisson|fixed] | /traffic off" << std::endl;
+        else if (!linked.load(std::memory_order_acquire))
+            ui.print(NC_RED) << "Not linked yet." << std::endl;
+        else {
+            bool poisson;
+            {
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                poisson = params.size() > 1 ? params[1] == "poisson" : trafficPoisson;
+            }
+            startTraffic(rate, poisson);
+        }
+    } else if (input == "/stats") {
+        conn->ReportStats();
+    } else if (input == "/net" || input.rfind("/net ", 0) == 0) {
+        show_network(input.size() > 5 ? input.substr(5) : "");
     } else if (input.rfind("/sq", 0) == 0) {
         std::string message = "Leaving...";
         if (input.size() > 3) message = input.substr(4);
@@ -100,24 +230,399 @@ void telnERV::Banner() const {
     ui.print << "######################################" << std::endl;
 }
 
-void telnERV::burstClient(std::string nick, std::string user, std::string host, std::string modes) {
+void BurstTemplate::assign(const std::string& pattern) {
+    size_t pos = pattern.find("%d");
+    numbered = pos != std::string::npos;
+    prefix = pattern.substr(0, pos);
+    suffix = numbered ? pattern.substr(pos + 2) : "";
+}
+
+void BurstTemplate::append(std::string& out, unsigned int n) const {
+    out += prefix;
+    if (numbered) {
+        char digits[16];
+        auto res = std::to_chars(digits, digits + sizeof(digits), n);
+        out.append(digits, res.ptr);
+        out += suffix;
+    }
+}
+
+// YY N <nick> <hop> <ts> <user> <host> <modes> <base64 IP> <YYXXX> :<realname>
+void telnERV::appendClientLine(std::string& out, unsigned int numeric, std::string_view nick, std::string_view user,
+                               std::string_view host, std::string_view modes, unsigned int ip, std::string_view ts,
+                               std::string_view realname) {
+    char ipbuf[7];
     char XXX[4];
-    inttobase64(XXX, clients, 3);
-    conn->SendData(serverYY + " N " + nick + " " + std::to_string(time(nullptr)) + " " + std::to_string(time(nullptr)) + " " + user + " " + host + " " + modes + " AAAAA " + serverYY + XXX + " :telnERV client");
-    clients++;
+    inttobase64(ipbuf, ip, 6);
+    inttobase64(XXX, numeric, 3);
+
+    out += serverYY;
+    out += " N ";
+    out += nick;
+    out += " 1 ";
+    out += ts;
+    out += ' ';
+    out += user;
+    out += ' ';
+    out += host;
+    out += ' ';
+    out += modes;
+    out += ' ';
+    out += ipbuf;
+    out += ' ';
+    out += serverYY;
+    out += XXX;
+    out += " :";
+    out += realname;
+}
+
+void telnERV::burstClient(std::string nick, std::string user, std::string host, std::string modes) {
+    std::string line;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        unsigned int numeric;
+        if (!numerics.Alloc(numeric)) {
+            ui.print(NC_RED) << "No client numerics left." << std::endl;
+            return;
+        }
+        setClientNick(numeric, nick);
+        appendClientLine(line, numeric, nick, user, host, modes, 0, std::to_string(time(nullptr)), "telnERV client");
+        if (trafficOn)
+            scheduleTraffic(numeric);
+    }
+    conn->SendData(line);
 
     ui.print(NC_RED) << "Bursted client " << nick << "!" << user << "@" << host << std::endl;
 }
 
-bool telnERV::Parse(const std::string& display_line, const std::string& parsed_line) {
-    ui.print << get_timestamp() << " -> " << display_line << std::endl;
+// Pregenerates 'count' N lines from the burst templates into one buffer and queues it as a single write.
+void telnERV::massBurst(unsigned int count, const std::string& modes) {
+    std::unique_lock<std::mutex> lock(clientsMutex);
+    if (count > numerics.Available()) {
+        ui.print(NC_RED) << "Only " << numerics.Available() << " client numerics left." << std::endl;
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string ts = std::to_string(time(nullptr));
+    std::string burst;
+    burst.reserve(static_cast<size_t>(count) * (96 + burstNick.prefix.size() + burstUser.prefix.size()
+        + burstHost.prefix.size() + burstHost.suffix.size() + burstRealname.size()));
+
+    ownNumerics.reserve(numerics.InUseCount() + count);
+    std::string nick, user, host;
+    for (unsigned int i = 0; i < count; ++i) {
+        unsigned int n = burstSerial++;
+        unsigned int numeric = 0;  // Available() was checked above.
+        numerics.Alloc(numeric);
+        nick.clear(); burstNick.append(nick, n);
+        user.clear(); burstUser.append(user, n);
+        host.clear(); burstHost.append(host, n);
+        appendClientLine(burst, numeric, nick, user, host, modes, burstIP + n, ts, burstRealname);
+        burst += "\r\n";
+        setClientNick(numeric, nick);
+        if (trafficOn)
+            scheduleTraffic(numeric);
+    }
+    lock.unlock();
+    auto generated = std::chrono::steady_clock::now();
 
-    Params params = Tokenizer(parsed_line);
+    size_t bytes = burst.size();
+    if (!linked.load(std::memory_order_acquire)) {
+        burstSent = generated;
+        burstTimed.store(true, std::memory_order_release);
+    }
+    conn->SendRaw(std::move(burst), count);
+
+    ui.print(NC_YELLOW) << "Bursting " << count << " clients (" << bytes << " bytes), generated in "
+                        << std::chrono::duration<double, std::milli>(generated - start).count() << " ms" << std::endl;
+}
+
+// Bursts a channel with the first <count> of our clients as members.
+void telnERV::channelBurst(const std::string& channel, unsigned int count, unsigned int ops, unsigned int voices,
+                           unsigned int bans, const std::string& modes) {
+    std::vector<uint32_t> members;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        if (count > numerics.InUseCount()) {
+            ui.print(NC_RED) << "Only " << numerics.InUseCount() << " clients of ours to join " << channel << "." << std::endl;
+            return;
+        }
+        members.reserve(count);
+        for (unsigned int n = 0; members.size() < count; ++n) {
+            if (!numerics.InUse(n))
+                continue;
+            // Spread ops and voices evenly, with an independent pattern so some members get both.
+            size_t i = members.size();
+            uint32_t flags = (i % 100 < ops ? P10_MEMBER_OP : 0) | ((i * 37 + 11) % 100 < voices ? P10_MEMBER_VOICE : 0);
+            members.push_back(((static_cast<uint32_t>(intYY) << P10_CLIENT_BITS | n) << P10_MEMBER_FLAGS) | flags);
+        }
+    }
+
+    std::vector<std::string> banlist;
+    banlist.reserve(bans);
+    for (unsigned int i = 0; i < bans; ++i)
+        banlist.push_back("*!*@ban" + std::to_string(i) + "." + serverName);
+
+    auto start = std::chrono::steady_clock::now();
+    std::string burst;
+    burst.reserve((count * 6 + bans * (serverName.size() + 16)) * 11 / 10 + 512);
+    size_t lines = p10_channel_burst(burst, serverYY, channel, time(nullptr), modes, members, banlist);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t bytes = burst.size() - 2 * lines;
+    ui.print(NC_YELLOW) << "Bursting " << channel << ": " << count << " members, " << bans << " bans in " << lines
+                        << " B lines (" << bytes << " bytes, " << 100.0 * bytes / (lines * P10_MAX_LINE)
+                        << "% of " << P10_MAX_LINE << "-byte lines), generated in " << ms << " ms" << std::endl;
+    conn->SendRaw(std::move(burst), lines);
+}
+
+// Finds one of our clients by nick, sends its QUIT and releases the numeric.
+void telnERV::quitClient(const std::string& nick, const std::string& reason) {
+    char numeric[6];
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        auto it = ownNumerics.find(nick);
+        if (it == ownNumerics.end()) {
+            ui.print(NC_RED) << "No such client of ours: " << nick << std::endl;
+            return;
+        }
+        unsigned int n = it->second;
+        releaseClient(n);
+        std::memcpy(numeric, serverYY.data(), 2);
+        inttobase64(numeric + 2, n, 3);
+    }
+    conn->SendData(std::string(numeric) + " Q :" + reason);
+}
+
+// Frees a numeric and forgets its traffic state. clientsMutex must be held.
+void telnERV::releaseClient(unsigned int n) {
+    trafficWheel.Cancel(n);
+    if (trafficJoined[n] != 0)
+        trafficMembers[trafficJoined[n] - 1]--;
+    trafficJoined[n] = 0;
+    trafficWallops[n] = 0;
+    numerics.Free(n);
+    setClientNick(n, "");
+}
+
+// Renames client n and keeps the nick index in step; an empty nick just unindexes it.
+// A nick taken over by a newer client stays pointed at that one. clientsMutex must be held.
+void telnERV::setClientNick(unsigned int n, std::string_view nick) {
+    auto it = ownNumerics.find(ownNicks[n]);
+    if (it != ownNumerics.end() && it->second == n)
+        ownNumerics.erase(it);
+    ownNicks[n].assign(nick);
+    if (!nick.empty())
+        ownNumerics.insert_or_assign(ownNicks[n], n);
+}
+
+// Parses "privmsg:70,join:10,..." into relative event weights.
+bool telnERV::parseTrafficMix(const std::string& mix) {
+    static const char* names[TRAFFIC_EVENTS] = { "privmsg", "join", "part", "nick", "mode" };
+    std::fill(std::begin(trafficMix), std::end(trafficMix), 0);
+    size_t start = 0;
+    while (start < mix.size()) {
+        size_t end = mix.find(',', start);
+        if (end == std::string::npos)
+            end = mix.size();
+        std::string item = mix.substr(start, end - start);
+        size_t colon = item.find(':');
+        if (colon == std::string::npos)
+            return false;
+        unsigned int event = 0;
+        while (event < TRAFFIC_EVENTS && item.compare(0, colon, names[event]) != 0)
+            ++event;
+        if (event == TRAFFIC_EVENTS)
+            return false;
+        auto [ptr, ec] = std::from_chars(item.data() + colon + 1, item.data() + item.size(), trafficMix[event]);
+        if (ec != std::errc() || ptr != item.data() + item.size())
+            return false;
+        start = end + 1;
+    }
+    trafficMixTotal = 0;
+    for (unsigned int weight : trafficMix)
+        trafficMixTotal += weight;
+    return trafficMixTotal > 0;
+}
+
+void telnERV::startTraffic(double rate, bool poisson) {
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        trafficRate = rate;
+        trafficPoisson = poisson;
+        trafficWheel.Reset(maxClients, 0);
+        trafficEpoch = trafficReported = std::chrono::steady_clock::now();
+        trafficEvents = 0;
+        for (unsigned int n = 0; n < numerics.Limit(); ++n)
+            if (numerics.InUse(n))
+                scheduleTraffic(n);
+        trafficOn = true;
+    }
+    ui.print(NC_YELLOW) << "Traffic: " << rate << " events/s (" << (poisson ? "poisson" : "fixed") << ") across "
+                        << trafficWheel.Pending() << " clients" << std::endl;
+    conn->Wakeup();
+}
+
+void telnERV::stopTraffic() {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    trafficOn = false;
+    trafficWheel.Reset(maxClients, 0);
+    ui.setHeader("");
+}
+
+// Gap until a client's next event, in ticks: each client gets an equal share of the target rate.
+double telnERV::trafficDelay() {
+    double mean = numerics.InUseCount() / trafficRate * 1000.0 / trafficTick;
+    if (!trafficPoisson)
+        return mean;
+    return -std::log1p(-std::uniform_real_distribution<double>()(trafficRng)) * mean;
+}
+
+// Schedules a client's first event. clientsMutex must be held.
+void telnERV::scheduleTraffic(unsigned int n) {
+    double gap = trafficDelay();
+    // Fixed gaps start at a random phase so the clients don't fire in lockstep.
+    if (!trafficPoisson)
+        gap *= std::uniform_real_distribution<double>()(trafficRng);
+    trafficDue[n] = trafficWheel.Now() + gap;
+    trafficWheel.Schedule(n, static_cast<uint64_t>(std::ceil(trafficDue[n])));
+}
+
+// Appends one event line for client n. clientsMutex must be held.
+void telnERV::emitTraffic(unsigned int n, std::string& out, const std::string& ts) {
+    unsigned int pick = trafficRng() % trafficMixTotal;
+    unsigned int event = 0;
+    while (pick >= trafficMix[event])
+        pick -= trafficMix[event++];
+    // A client is on at most one channel: JOIN and PART swap roles when they don't apply.
+    if (event == TRAFFIC_JOIN && trafficJoined[n] != 0)
+        event = TRAFFIC_PART;
+    else if (event == TRAFFIC_PART && trafficJoined[n] == 0)
+        event = TRAFFIC_JOIN;
+
+    char numeric[4];
+    inttobase64(numeric, n, 3);
+    out += serverYY;
+    out.append(numeric, 3);
+
+    switch (event) {
+    case TRAFFIC_PRIVMSG:
+        out += " P ";
+        if (trafficJoined[n] != 0) {
+            trafficChannel.append(out, trafficJoined[n] - 1);
+        } else {
+            // Message another client of ours, or ourselves if a few random picks miss.
+            unsigned int target = n;
+            for (int tries = 0; tries < 4; ++tries) {
+                unsigned int candidate = trafficRng() % numerics.Limit();
+                if (numerics.InUse(candidate)) {
+                    target = candidate;
+                    break;
+                }
+            }
+            inttobase64(numeric, target, 3);
+            out += serverYY;
+            out.append(numeric, 3);
+        }
+        out += " :";
+        out += trafficMessage;
+        break;
+    case TRAFFIC_JOIN: {
+        unsigned int channel = trafficRng() % trafficMembers.size();
+        // The first of our clients on a channel creates it.
+        out += trafficMembers[channel] == 0 ? " C " : " J ";
+        trafficChannel.append(out, channel);
+        out += ' ';
+        out += ts;
+        trafficMembers[channel]++;
+        trafficJoined[n] = channel + 1;
+        break;
+    }
+    case TRAFFIC_PART:
+        out += " L ";
+        trafficChannel.append(out, trafficJoined[n] - 1);
+        out += " :Leaving";
+        trafficMembers[trafficJoined[n] - 1]--;
+        trafficJoined[n] = 0;
+        break;
+    case TRAFFIC_NICK: {
+        std::string nick;
+        burstNick.append(nick, burstSerial++);
+        setClientNick(n, nick);
+        out += " N ";
+        out += ownNicks[n];
+        out += ' ';
+        out += ts;
+        break;
+    }
+    case TRAFFIC_MODE:
+        out += " M ";
+        out += ownNicks[n];
+        out += trafficWallops[n] ? " :-w" : " :+w";
+        trafficWallops[n] ^= 1;
+        break;
+    }
+    out += "\r\n";
+}
+
+// Fires every traffic event due by now and sends them as one batch.
+int telnERV::OnTimer() {
+    if (!trafficOn.load(std::memory_order_acquire))
+        return -1;
+
+    auto now = std::chrono::steady_clock::now();
+    std::string batch;
+    size_t lines = 0;
+    long long elapsed;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        if (!trafficOn)
+            return -1;
+        elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - trafficEpoch).count();
+        uint64_t tick = elapsed / trafficTick;
+        std::string ts = std::to_string(time(nullptr));
+        trafficWheel.Advance(tick, [&](unsigned int n) {
+            do {
+                emitTraffic(n, batch, ts);
+                lines++;
+                trafficDue[n] += trafficDelay();
+            } while (trafficDue[n] <= tick);
+            trafficWheel.Schedule(n, static_cast<uint64_t>(std::ceil(trafficDue[n])));
+        });
+        trafficEvents += lines;
+
+        auto since = std::chrono::duration<double>(now - trafficReported).count();
+        if (since * 1000 >= TRAFFIC_REPORT_INTERVAL) {
+            std::ostringstream header;
+            header << std::fixed << std::setprecision(0) << "Traffic: target " << trafficRate << "/s ("
+                   << (trafficPoisson ? "poisson" : "fixed") << "), achieved " << trafficEvents / since
+                   << "/s, " << trafficWheel.Pending() << " timers, " << conn->WriteBacklog() << " bytes queued";
+            ui.setHeader(header.str());
+            trafficReported = now;
+            trafficEvents = 0;
+        }
+    }
+
+    if (lines > 0)
+        conn->SendRaw(std::move(batch), lines);
+    return static_cast<int>(trafficTick - elapsed % trafficTick);
+}
+
+bool telnERV::Parse(const IrcMessage& line) {
+    ui.print << get_timestamp() << " -> " << line.raw << std::endl;
+
+    IrcMessage msg = line;
+    p10_normalize(msg);
+    network.Dispatch(msg);
 
     // msg_SERVER
-    if (params.size() > 7 && params[0] == "SERVER") {
-        uplinkName = params[1];
-        uplinkYY = params[6].substr(0, 2);
+    // SERVER name hop start link J10 YYXXX +flags :description
+    if (msg.command == "SERVER" && msg.param_count > 6) {
+        uplinkName = msg.params[0];
+        uplinkYY = msg.params[5].substr(0, 2);
+        ingestStart = std::chrono::steady_clock::now();
+        ingestLines = network.LinesApplied();
 
         // Output the results
         ui.print(NC_YELLOW) << "Uplink Name: " << uplinkName << std::endl;
@@ -127,33 +632,70 @@ bool telnERV::Parse(const std::string& display_line, const std::string& parsed_l
     }
 
     // msg_EB
-    if (params.size() > 1 &&
-        params[1] == "EB" &&
-        params[0] == uplinkYY) {
-        
+    if (msg.command == "EB" && msg.source == uplinkYY) {
         /* Complete burst. */
         conn->SendData(serverYY + " EB");
         conn->SendData(serverYY + " EA");
 
         ui.print(NC_YELLOW) << "Burst completed." << std::endl;
 
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - ingestStart).count();
+        uint64_t lines = network.LinesApplied() - ingestLines;
+        ui.print(NC_YELLOW) << "Absorbed uplink burst: " << network.ServerCount() << " servers, "
+                            << network.UserCount() << " users, " << network.ChannelCount() << " channels, "
+                            << network.MembershipCount() << " memberships from " << lines << " lines in "
+                            << ms << " ms (" << (ms > 0 ? lines * 1000.0 / ms : 0.0) << " lines/s)" << std::endl;
+
+        return true;
+    }
+
+    // msg_EA: the uplink has processed our whole burst.
+    if (msg.command == "EA" && msg.source == uplinkYY) {
+        linked.store(true, std::memory_order_release);
+        // /traffic may be changing these from the UI thread.
+        double rate;
+        bool poisson;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            rate = trafficRate;
+            poisson = trafficPoisson;
+        }
+        if (rate > 0 && !trafficOn)
+            startTraffic(rate, poisson);
+        if (burstTimed.exchange(false, std::memory_order_acq_rel)) {
+            auto elapsed = std::chrono::steady_clock::now() - burstSent;
+            ui.print(NC_YELLOW) << "Uplink acknowledged burst (EA) after "
+                                << std::chrono::duration<double, std::milli>(elapsed).count() << " ms" << std::endl;
+        }
+        return true;
+    }
+
+    // msg_D: one of our clients was killed; its numeric becomes free again.
+    // <source> D <YYXXX> :<path> (<reason>)
+    if (msg.command == "D" && msg.param(0).size() == 5 && msg.param(0).substr(0, 2) == serverYY) {
+        unsigned int n = base64toint(msg.params[0].data() + 2, 3);
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        if (numerics.InUse(n)) {
+            ui.print(NC_RED) << "Client " << ownNicks[n] << " was killed: " << msg.param(1) << std::endl;
+            releaseClient(n);
+        }
         return true;
     }
 
     // msg_G
     // AB G !1736027261.141624 server.name 1736027261.141624
     // A3 Z A3 !1736027261.141624 1736027261.141624 0 1736027261.141800
-    if (params.size() > 4 && params[1] == "G") {
+    if (msg.command == "G" && msg.param_count > 2) {
         std::stringstream message;
         message << serverYY
                 << " Z "
-                << params[0]
+                << msg.source
                 << " "
-                << params[2]
+                << msg.params[0]
                 << " "
-                << params[4]
+                << msg.params[2]
                 << " 0 "
-                << params[4];
+                << msg.params[2];
 
         conn->SendData(message.str());
         return true;
@@ -167,4 +709,48 @@ void telnERV::show_help() const {
     ui.print << "/h                              - Show this help message" << std::endl;
     ui.print << "/sq [msg]                       - Squits" << std::endl;
     ui.print << "/n <nick> <user> <host> [modes] - Bursts a new client" << std::endl;
+    ui.print << "/burst <count> [modes]          - Bursts <count> clients from the burst_* templates" << std::endl;
+    ui.print << "/net [nick|#channel]            - Shows network totals, a user or a channel" << std::endl;
+    ui.print << "/cburst <#chan> <members> [op%] [voice%] [bans] [+modes] - Bursts a channel of our clients" << std::endl;
+    ui.print << "/quit <nick> [reason]           - Quits one of our clients and frees its numeric" << std::endl;
+    ui.print << "/traffic <rate> [poisson|fixed] - Makes our clients send <rate> events/s; /traffic off stops" << std::endl;
+    ui.print << "/stats                          - Shows latency histograms and I/O counters" << std::endl;
+}
+
+void telnERV::show_network(const std::string& target) const {
+    if (target.empty()) {
+        ui.print(NC_YELLOW) << "Network: " << network.ServerCount() << " servers, " << network.UserCount() << " users, "
+                            << network.ChannelCount() << " channels, " << network.MembershipCount() << " memberships" << std::endl;
+        return;
+    }
+
+    if (target[0] == '#' || target[0] == '&') {
+        P10Channel chan;
+        if (!network.LookupChannel(target, chan)) {
+            ui.print(NC_RED) << "No such channel: " << target << std::endl;
+            return;
+        }
+        size_t ops = 0, voices = 0;
+        for (uint32_t m : chan.members) {
+            ops += (m & P10_MEMBER_OP) != 0;
+            voices += (m & P10_MEMBER_VOICE) != 0;
+        }
+        ui.print(NC_YELLOW) << chan.name << " ts " << chan.ts << " modes " << P10Network::ModeString(chan.modes)
+                            << ": " << chan.members.size() << " members (" << ops << " ops, " << voices << " voiced), "
+                            << chan.bans.size() << " bans" << std::endl;
+        return;
+    }
+
+    P10User user;
+    if (!network.LookupUser(target, user)) {
+        ui.print(NC_RED) << "No such user: " << target << std::endl;
+        return;
+    }
+    char numeric[6];
+    inttobase64(numeric, user.numeric >> P10_CLIENT_BITS, 2);
+    inttobase64(numeric + 2, user.numeric & ((1u << P10_CLIENT_BITS) - 1), 3);
+    ui.print(NC_YELLOW) << user.nick << "!" << user.user << "@" << user.host << " (" << numeric << ") "
+                        << P10Network::ModeString(user.modes)
+                        << (user.account.empty() ? "" : " account " + user.account)
+                        << " on " << user.channels.size() << " channels: " << user.realname << std::endl;
 }
\ No newline at end of file
@@ -16,7 +16,9 @@
  * USA.
  */
 
-#include <regex>
+#include <algorithm>
+#include <cctype>
+#include <sstream>
 
 #include "config.h"
 #include "misc.h"
@@ -34,104 +36,395 @@ telnIRC::telnIRC(const std::string& configFile, UIManager& ui)
         ui.fatal("Error loading configuration file: " + configFile);
     }
 
+    log_file = config.get<std::string>("logfile", "");
+    logFlushInterval = config.get<unsigned int>("log_flush_ms", DEFAULT_LOG_FLUSH_INTERVAL);
+    logFlushBytes = config.get<size_t>("log_flush_bytes", DEFAULT_LOG_FLUSH_BYTES);
+    if (!parse_timestamp_precision(config.get<std::string>("log_timestamps", "s"), logTimestampPrecision))
+        ui.fatal("Invalid log_timestamps value. Use s, ms or us.");
+    ui.setScrollback(config.get<size_t>("scrollback", DEFAULT_SCROLLBACK_LINES));
+    maxQueries = config.get<size_t>("max_queries", DEFAULT_MAX_QUERIES);
+
+    // Every listed network has a [telnIRC:<name>] section whose keys override those in [telnIRC].
+    std::string list = config.get<std::string>("networks", "");
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::istringstream names(list);
+    std::string name;
+    while (names >> name) {
+        if (name.find('/') != std::string::npos || findNetwork(name))
+            ui.fatal("Invalid or duplicate network name: " + name);
+        ConfigParser section;
+        section.load(configFile, "telnIRC");
+        section.load(configFile, "telnIRC:" + name);
+        if (!section.foundSection())
+            ui.fatal("Missing config section [telnIRC:" + name + "]");
+        networks.push_back(std::make_unique<Network>());
+        networks.back()->name = name;
+        loadNetwork(*networks.back(), section);
+    }
+    if (networks.empty()) {
+        networks.push_back(std::make_unique<Network>());
+        loadNetwork(*networks.back(), config);
+    }
+    if (networks.size() > 1) {
+        for (auto& net : networks)
+            net->label = "[" + net->name + "] ";
+    }
+    currentNetwork = networks.front().get();
+    windows.resize(STATUS_BUFFER + 1);
+}
+
+void telnIRC::loadNetwork(Network& net, const ConfigParser& config) {
     std::string host_value = config.get<std::string>("host", "127.0.0.1:6667");
-    if (!parse_host(host_value, 6667, host)) {
+    if (!parse_host(host_value, 6667, net.host)) {
         ui.fatal("Error parsing host: " + host_value);
     }
-    password = config.get<std::string>("password", "");
-    nickname = config.get<std::string>("nick", get_unix_username());
-    username = config.get<std::string>("user", nickname);
-    log_file = config.get<std::string>("logfile", "");
-    use_cap = config.get<bool>("cap", true);
-    use_tls = config.get<bool>("tls", false);
-    caCertFile = config.get<std::string>("tls_cacert", "");
-    clientCertFile = config.get<std::string>("tls_certfile", "");
-    if (clientCertFile.empty())
-        clientCertFile = config.get<std::string>("tls_cert", "");
-    clientKeyFile = config.get<std::string>("tls_keyfile", "");
-    if (clientKeyFile.empty())
-        clientKeyFile = config.get<std::string>("tls_key", "");
+    net.password = config.get<std::string>("password", "");
+    net.nickname = config.get<std::string>("nick", get_unix_username());
+    net.username = config.get<std::string>("user", net.nickname);
+    net.use_cap = config.get<bool>("cap", true);
+    net.use_tls = config.get<bool>("tls", false);
+    net.caCertFile = config.get<std::string>("tls_cacert", "");
+    net.clientCertFile = config.get<std::string>("tls_certfile", "");
+    if (net.clientCertFile.empty())
+        net.clientCertFile = config.get<std::string>("tls_cert", "");
+    net.clientKeyFile = config.get<std::string>("tls_keyfile", "");
+    if (net.clientKeyFile.empty())
+        net.clientKeyFile = config.get<std::string>("tls_key", "");
+    net.recvBufferSize = config.get<size_t>("recv_buffer", DEFAULT_RECV_BUFFER);
+    net.captureFile = config.get<std::string>("capture", "");
+    net.statsFile = config.get<std::string>("stats_file", "");
+    net.statsInterval = config.get<unsigned int>("stats_interval", DEFAULT_STATS_INTERVAL);
+    net.wsDeflate.enabled = config.get<bool>("ws_deflate", false);
+    net.wsDeflate.client_no_context_takeover = config.get<bool>("ws_deflate_client_no_context_takeover", false);
+    net.wsDeflate.server_no_context_takeover = config.get<bool>("ws_deflate_server_no_context_takeover", false);
+    net.wsDeflate.client_max_window_bits = config.get<int>("ws_deflate_client_window_bits", WS_DEFLATE_MAX_WINDOW_BITS);
+    net.wsDeflate.server_max_window_bits = config.get<int>("ws_deflate_server_window_bits", WS_DEFLATE_MAX_WINDOW_BITS);
+    if (net.wsDeflate.client_max_window_bits < WS_DEFLATE_MIN_WINDOW_BITS || net.wsDeflate.client_max_window_bits > WS_DEFLATE_MAX_WINDOW_BITS
+        || net.wsDeflate.server_max_window_bits < 8 || net.wsDeflate.server_max_window_bits > WS_DEFLATE_MAX_WINDOW_BITS)
+        ui.fatal("Invalid ws_deflate window bits (client 9-15, server 8-15).");
 }
 
 telnIRC::~telnIRC() {
-    delete conn; conn = nullptr;
+    if (loop)
+        loop->Stop();
+    for (auto& net : networks) {
+        delete net->conn; net->conn = nullptr;
+    }
+    delete logger; logger = nullptr;
 }
 
 void telnIRC::Attach() {
     // Initiate logger
     if (!log_file.empty()) {
         logger = new Logger();
+        logger->setFlushPolicy(logFlushInterval, logFlushBytes);
+        logger->setTimestampPrecision(logTimestampPrecision);
         logger->open(log_file);
         logger->log("telnIRC started");
     }
 
-    // Initiate connection.
-    conn = new ConnectionManager(this, ui, logger, host,
-        use_tls, caCertFile, clientCertFile, clientKeyFile);
+    if (!replayFile.empty()) {
+        // The first network reads the capture instead of connecting; the others stay offline.
+        Network& net = *networks.front();
+        net.conn = new ConnectionManager(this, ui, logger, replayFile, replayPaced, net.recvBufferSize);
+        byConnection[net.conn] = &net;
+        net.conn->Start();
+        sendRegistration(net);
+        return;
+    }
+
+    // Initiate connections. They all share one I/O thread.
+    loop = std::make_unique<EventLoop>(ui);
+    for (auto& net : networks) {
+        net->conn = new ConnectionManager(this, ui, logger, net->host, net->use_tls, net->caCertFile,
+            net->clientCertFile, net->clientKeyFile, net->recvBufferSize, net->wsDeflate, net->captureFile);
+        if (networks.size() > 1)
+            net->conn->SetName(net->name);
+        if (!net->statsFile.empty())
+            net->conn->SetStatsDump(net->statsFile, net->statsInterval);
+        byConnection[net->conn] = net.get();
+        loop->Add(net->conn);
+    }
 
     // Start receiving loop in a thread.
-    conn->Start();
+    loop->Start();
+
+    for (auto& net : networks)
+        sendRegistration(*net);
+}
 
-    if (!password.empty()) {
-        conn->SendData("PASS :" + password);
+void telnIRC::sendRegistration(Network& net) {
+    if (!net.password.empty()) {
+        net.conn->SendData("PASS :" + net.password);
     }
 
-    if (use_cap) {
-        conn->SendData("CAP LS");
+    if (net.use_cap) {
+        net.conn->SendData("CAP LS");
     }
 
-    conn->SendData("NICK " + nickname);
-    conn->SendData("USER " + username + " 0 * :" + nickname);
+    net.conn->SendData("NICK " + net.nickname);
+    net.conn->SendData("USER " + net.username + " 0 * :" + net.nickname);
 }
 
 void telnIRC::Detach() {
-    conn->Stop();
+    if (loop)
+        loop->Stop();
+    for (auto& net : networks) {
+        if (net->conn)
+            net->conn->Stop();
+    }
+}
+
+telnIRC::Network* telnIRC::findNetwork(std::string_view name) {
+    for (auto& net : networks) {
+        if (net->name == name)
+            return net.get();
+    }
+    return nullptr;
+}
+
+telnIRC::Network* telnIRC::resolveTarget(std::string& target) {
+    size_t slash = target.find('/');
+    if (slash != std::string::npos && networks.size() > 1) {
+        if (Network* net = findNetwork(std::string_view(target).substr(0, slash))) {
+            target.erase(0, slash + 1);
+            return net;
+        }
+    }
+    std::string active;
+    return activeWindow(active);
+}
+
+telnIRC::Network* telnIRC::activeWindow(std::string& target) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    size_t id = ui.activeBuffer();
+    if (id < windows.size() && windows[id].net) {
+        currentNetwork = windows[id].net;
+        target = windows[id].target;
+    } else {
+        target.clear();
+    }
+    return currentNetwork;
+}
+
+static bool is_channel(std::string_view name) {
+    return !name.empty() && (name.front() == '#' || name.front() == '&' || name.front() == '+' || name.front() == '!');
+}
+
+size_t telnIRC::bufferFor(Network& net, std::string_view target, bool create) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    auto it = net.buffers.find(target);
+    if (it != net.buffers.end())
+        return it->second;
+    if (!create || target.empty())
+        return STATUS_BUFFER;
+    return openWindowLocked(net, target);
+}
+
+size_t telnIRC::queryBuffer(Network& net, std::string_view nick) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    auto it = net.buffers.find(nick);
+    if (it != net.buffers.end())
+        return it->second;
+    if (nick.empty() || queryCount >= maxQueries)
+        return STATUS_BUFFER;
+    return openWindowLocked(net, nick);
+}
+
+// Opens a buffer for a target that has none. bufferMutex must be held.
+size_t telnIRC::openWindowLocked(Network& net, std::string_view target) {
+    size_t id = ui.openBuffer(qualified(net, std::string(target)));
+    net.buffers.emplace(target, id);
+    if (windows.size() <= id)
+        windows.resize(id + 1);
+    bool query = !is_channel(target);
+    windows[id] = Window{&net, std::string(target), query};
+    if (query)
+        queryCount++;
+    return id;
+}
+
+// Forgets a buffer's target and closes it, so its scrollback is freed and its id reused.
+void telnIRC::closeWindow(size_t id) {
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        if (id == STATUS_BUFFER || id >= windows.size() || !windows[id].net)
+            return;
+        Window& window = windows[id];
+        window.net->buffers.erase(window.target);
+        if (window.query)
+            queryCount--;
+        window = Window();
+    }
+    ui.closeBuffer(id);
+}
+
+// Channel traffic goes to the channel's buffer and private messages to the sender's;
+// channels are only opened by messages and joins, queries only up to maxQueries, and
+// everything else goes to status.
+size_t telnIRC::route(Network& net, const IrcMessage& msg) {
+    std::string_view target;
+    bool create = false;
+    if (msg.command == "PRIVMSG" || msg.command == "NOTICE") {
+        target = msg.param(0);
+        if (!is_channel(target)) {
+            // A query from a user, but not a CTCP request or reply other than ACTION.
+            std::string_view text = msg.param(1);
+            if (msg.source.find('!') == std::string_view::npos || !NoCaseEqual()(target, net.nickname)
+                || (text.rfind('\x01', 0) == 0 && text.rfind("\x01" "ACTION ", 0) != 0))
+                return STATUS_BUFFER;
+            return queryBuffer(net, msg.nick());
+        }
+        create = true;
+    } else if (msg.command == "JOIN") {
+        target = msg.param(0);
+        create = true;
+    } else if (msg.command == "PART" && msg.nick() == net.nickname) {
+        // Our own PART closes the channel's buffer (handle_part), so it is shown in status.
+        return STATUS_BUFFER;
+    } else if (msg.command == "PART" || msg.command == "KICK" || msg.command == "TOPIC" || msg.command == "MODE") {
+        target = msg.param(0);
+    } else if (msg.command.size() == 3 && std::isdigit(static_cast<unsigned char>(msg.command[0]))) {
+        // Numerics about a channel (topic, names, modes, bans...) name it after our nick; NAMES adds a type.
+        target = msg.param(msg.command == "353" ? 2 : 1);
+    }
+    return is_channel(target) ? bufferFor(net, target, create) : STATUS_BUFFER;
+}
+
+std::string telnIRC::qualified(const Network& net, const std::string& target) const {
+    return networks.size() > 1 ? net.name + "/" + target : target;
+}
+
+void telnIRC::setCurrentBuffer(Network& net, const std::string& target, const char* what, bool always) {
+    size_t id = bufferFor(net, target, true);
+    if (!always && ui.activeBuffer() == id)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        currentNetwork = &net;
+    }
+    ui.print(NC_YELLOW, id) << what << qualified(net, target) << std::endl;
+    ui.switchBuffer(id);
+}
+
+// Queues a line for a network from the UI thread.
+bool telnIRC::send(Network& net, const std::string& line) {
+    if (!net.conn || net.conn->Closed()) {
+        ui.print(NC_RED) << net.label << "Not connected." << std::endl;
+        return false;
+    }
+    net.conn->SendData(line);
+    return true;
+}
+
+void telnIRC::show_networks() {
+    std::string active;
+    activeWindow(active);
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    for (auto& net : networks) {
+        const char* state = !net->conn ? "offline" : net->conn->Closed() ? "closed" : "connected";
+        ui.print(NC_YELLOW) << (net.get() == currentNetwork ? "* " : "  ") << (net->name.empty() ? "default" : net->name)
+                            << " " << net->host.original << " (" << state << ")" << std::endl;
+    }
 }
 
 void telnIRC::OnCommand(std::string input) {
+    std::string target;
+    Network* net = activeWindow(target);
+
     if (input == "/h") {
         show_help();
     } else if (input.rfind("/j ", 0) == 0 && input.size() > 3) {
         std::string channel = input.substr(3);
-        conn->SendData("JOIN " + channel);
+        send(*net, "JOIN " + channel);
     } else if (input.rfind("/w ", 0) == 0 && input.size() > 3) {
         std::string nick = input.substr(3);
-        conn->SendData("WHOIS " + nick);
+        send(*net, "WHOIS " + nick);
     } else if (input.rfind("/p ", 0) == 0 && input.size() > 3) {
         std::string channel = input.substr(3);
-        conn->SendData("PART " + channel);
-        currentBuffer.clear();
-        ui.setHeader("");
+        send(*net, "PART " + channel);
+        if (NoCaseEqual()(channel, target))
+            ui.switchBuffer(STATUS_BUFFER);
     } else if (input.rfind("/r ", 0) == 0  && input.size() > 3) {
         std::string message = input.substr(3);
-        conn->SendData(message);
+        send(*net, message);
     } else if (input.rfind("/q", 0) == 0) {
         std::string message = "Leaving...";
     if (input.size() > 2) message = input.substr(3);
-        conn->SendData("QUIT :" + message);
+        for (auto& each : networks) {
+            if (each->conn && !each->conn->Closed())
+                each->conn->SendData("QUIT :" + message);
+        }
         stop_program = 1;
     } else if (input.rfind("/n ", 0) == 0 && input.size() > 3) {
-        conn->SendData("NICK " + input.substr(3));
+        send(*net, "NICK " + input.substr(3));
     } else if (input.rfind("/msg ", 0) == 0 && input.size() > 5) {
         std::string remainder = input.substr(5);
         size_t first_space = remainder.find(' ');
         if (first_space != std::string::npos) {
             std::string target = remainder.substr(0, first_space);
             std::string message = remainder.substr(first_space + 1);
-            conn->SendData("PRIVMSG " + target + " :" + message);
-            if (currentBuffer != target) {
-                currentBuffer = target; // Update currentBuffer
-                ui.print(NC_YELLOW) << "Current buffer updated to: " << currentBuffer << std::endl;
-                ui.setHeader("Current buffer: " + currentBuffer);
+            Network* to = resolveTarget(target);
+            if (send(*to, "PRIVMSG " + target + " :" + message))
+                setCurrentBuffer(*to, target, "Current buffer updated to: ");
+        }
+    } else if (input == "/sb") {
+        ui.listBuffers();
+    } else if (input.rfind("/sb ", 0) == 0 && input.size() > 4) {
+        std::string name = input.substr(4);
+        if (std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            // Nicks and channels never start with a digit, so this is a buffer number.
+            size_t id = name.size() < 10 ? std::stoul(name) : NO_BUFFER;
+            bool open;
+            {
+                std::lock_guard<std::mutex> lock(bufferMutex);
+                open = id == STATUS_BUFFER || (id < windows.size() && windows[id].net);
             }
+            if (open)
+                ui.switchBuffer(id);
+            else
+                ui.print(NC_RED) << "No such buffer: " << name << std::endl;
+        } else {
+            Network* to = resolveTarget(name);
+            setCurrentBuffer(*to, name, "Current buffer set to: ", true);
+        }
+    } else if (input == "/close" || input.rfind("/close ", 0) == 0) {
+        size_t id = ui.activeBuffer();
+        if (input.size() > 7) {
+            std::string name = input.substr(7);
+            Network* to = resolveTarget(name);
+            id = bufferFor(*to, name, false);
+        }
+        if (id == STATUS_BUFFER)
+            ui.print(NC_RED) << "No such buffer, or it is the status buffer." << std::endl;
+        else
+            closeWindow(id);
+    } else if (input == "/net") {
+        show_networks();
+    } else if (input.rfind("/net ", 0) == 0) {
+        Network* to = findNetwork(input.substr(5));
+        if (!to) {
+            ui.print(NC_RED) << "No such network: " << input.substr(5) << std::endl;
+        } else {
+            {
+                std::lock_guard<std::mutex> lock(bufferMutex);
+                currentNetwork = to;
+            }
+            ui.switchBuffer(STATUS_BUFFER);
+            ui.print(NC_YELLOW) << "Current network set to: " << to->name << std::endl;
+            ui.setHeader("Current network: " + to->name);
+        }
+    } else if (input == "/stats") {
+        for (auto& each : networks) {
+            if (!each->conn)
+                continue;
+            if (networks.size() > 1)
+                ui.print(NC_YELLOW) << each->label << each->host.original << std::endl;
+            each->conn->ReportStats();
         }
-    } else if (input.rfind("/sb ", 0) == 0) {
-        currentBuffer = input.substr(4);
-        ui.print(NC_YELLOW) << "Current buffer set to: " << currentBuffer << std::endl;
-        ui.setHeader("Current buffer: " + currentBuffer);
     } else if (!input.empty()) {
-        if (!currentBuffer.empty()) {
-            conn->SendData("PRIVMSG " + currentBuffer + " :" + input);
+        if (!target.empty()) {
+            send(*net, "PRIVMSG " + target + " :" + input);
         } else {
             ui.print(NC_YELLOW) << "No current buffer set. Please join a channel, set a buffer, or receive a direct message first." << std::endl;
         }
@@ -146,116 +439,171 @@ void telnIRC::Banner() const {
     ui.print << "######################################" << std::endl;
 }
 
-void telnIRC::handle_privmsg(const std::string& display_line, const std::string& parsed_line) {
+const std::unordered_map<std::string_view, telnIRC::Handler> telnIRC::handlers = {
+    { "001",  &telnIRC::handle_welcome },
+    { "433",  &telnIRC::handle_nick_in_use },
+    { "PING", &telnIRC::handle_ping },
+    { "JOIN", &telnIRC::handle_join },
+    { "NICK", &telnIRC::handle_nick },
+    { "PART", &telnIRC::handle_part },
+    { "CAP",  &telnIRC::handle_cap },
+};
+
+void telnIRC::handle_privmsg(Network& net, const IrcMessage& msg, size_t buffer) {
+    std::string_view target = msg.param(0);
+    std::string_view text = msg.param(1);
+
     // Handle color output first (show wire line including @tags)
-    bool contains_nickname = parsed_line.find(nickname) != std::string::npos;
+    bool contains_nickname = target == net.nickname || text.find(net.nickname) != std::string_view::npos;
     if (contains_nickname) {
-        ui.print(NC_RED) << get_timestamp() << " "
-                << "-> " << display_line << std::endl;
+        ui.print(NC_RED, buffer) << get_timestamp() << " " << net.label
+                << "-> " << msg.raw << std::endl;
     } else {
-        ui.print(NC_BLUE) << get_timestamp() << " "
-                << "-> " << display_line << std::endl;
+        ui.print(NC_BLUE, buffer) << get_timestamp() << " " << net.label
+                << "-> " << msg.raw << std::endl;
     }
 
-    // Extract sender nickname
-    size_t start_pos = parsed_line.find(":") + 1;
-    size_t end_pos = parsed_line.find("!");
-    std::string sender_nick = parsed_line.substr(start_pos, end_pos - start_pos);
-
-    // Handle CTCP commands
-    std::smatch ctcp_match;
-    std::regex ctcp_regex("\\x01([^\\s]+)(.*)\\x01");
-
-    if (std::regex_search(parsed_line, ctcp_match, ctcp_regex)) {
-        std::string ctcpCmd = ctcp_match[1];
-        std::string ctcpArgs = ctcp_match[2];
-
-        if (ctcpCmd == "VERSION") {
-            conn->SendData("NOTICE " + sender_nick + " :\x01VERSION telnIRC - theRealIRC\x01");
-            return;
-        } else if (ctcpCmd == "PING") {
-            conn->SendData("NOTICE " + sender_nick + " :\x01PING " + ctcpArgs + "\x01");
-            return;
+    std::string_view sender_nick = msg.nick();
+
+    // Handle CTCP commands: \x01CMD [args]\x01
+    if (text.size() > 2 && text.front() == '\x01') {
+        size_t close = text.find('\x01', 1);
+        if (close != std::string_view::npos) {
+            std::string_view ctcp = text.substr(1, close - 1);
+            size_t space = ctcp.find(' ');
+            std::string_view ctcpCmd = ctcp.substr(0, space);
+            std::string_view ctcpArgs = (space == std::string_view::npos) ? std::string_view() : ctcp.substr(space + 1);
+
+            if (ctcpCmd == "VERSION") {
+                net.conn->SendData("NOTICE " + std::string(sender_nick) + " :\x01VERSION telnIRC - theRealIRC\x01");
+                return;
+            } else if (ctcpCmd == "PING") {
+                net.conn->SendData("NOTICE " + std::string(sender_nick) + " :\x01PING " + std::string(ctcpArgs) + "\x01");
+                return;
+            }
         }
     }
+}
 
-    // Check if message is directed to us
-    std::regex privmsg_regex("^:[^\\s]+![^\\s]+ PRIVMSG " + nickname + " :.*$");
-    if (!std::regex_search(parsed_line, privmsg_regex)) {
-        return;  // Early return if not directed to us
-    }
-
-    // We only update the current buffer if the message is directed to us and is not CTCP
-    if (currentBuffer != sender_nick) {
-        currentBuffer = sender_nick;
-        ui.print(NC_YELLOW) << "Current buffer updated to user: " << currentBuffer << std::endl;
-        ui.setHeader("Current buffer: " + currentBuffer);
-    }
+bool telnIRC::Parse(const IrcMessage& msg) {
+    return parse(*networks.front(), msg);
 }
 
-bool telnIRC::Parse(const std::string& display_line, const std::string& parsed_line) {
-    std::smatch match;
+bool telnIRC::Receive(ConnectionManager* from, const IrcMessage& msg) {
+    auto it = byConnection.find(from);
+    return parse(it != byConnection.end() ? *it->second : *networks.front(), msg);
+}
 
+bool telnIRC::parse(Network& net, const IrcMessage& msg) {
     if (logger)
-        logger->log("-> " + display_line);
+        logger->log(net.label + "-> " + std::string(msg.raw));
+
+    size_t buffer = route(net, msg);
 
     // PRIVMSG handling (including color output)
-    if (std::regex_search(parsed_line, std::regex("^:[^\\s]+ PRIVMSG"))) {
-        handle_privmsg(display_line, parsed_line);
+    if (msg.command == "PRIVMSG" && !msg.source.empty()) {
+        handle_privmsg(net, msg, buffer);
         return true;
     }
 
     // Non-PRIVMSG messages are printed in default color
-    ui.print << get_timestamp() << " -> " << display_line << std::endl;
+    ui.print(NC_DEFAULT, buffer) << get_timestamp() << " " << net.label << "-> " << msg.raw << std::endl;
 
-    // Welcome message (001)
-    if (std::regex_search(parsed_line, match, std::regex("^:[^\\s]+ 001 ([^\\s]+)")) &&
-        match[1] != nickname) {
-        nickname = match[1];
-        ui.print << "Nickname updated to: " << nickname << std::endl;
-        return true;
-    }
+    auto handler = handlers.find(msg.command);
+    if (handler == handlers.end())
+        return false;
 
-    // Nickname in use (433)
-    if (std::regex_search(parsed_line, std::regex("^:[^\\s]+ 433"))) {
-        std::string new_nick = nickname + generate_random_number_string(12 - nickname.length());
-        conn->SendData("NICK " + new_nick);
-        nickname = new_nick;
-        ui.print(NC_YELLOW) << "Nickname in use. Changed to: " << new_nick << std::endl;
-        return true;
-    }
+    return (this->*handler->second)(net, msg);
+}
 
-    // PING response
-    if (parsed_line.rfind("PING ", 0) == 0) {
-        conn->SendData("PONG " + parsed_line.substr(5));
-        return true;
-    }
+// Welcome message (001)
+bool telnIRC::handle_welcome(Network& net, const IrcMessage& msg) {
+    if (msg.param_count == 0 || msg.params[0] == net.nickname)
+        return false;
+
+    net.nickname = msg.params[0];
+    ui.print << net.label << "Nickname updated to: " << net.nickname << std::endl;
+    return true;
+}
+
+// Nickname in use (433)
+bool telnIRC::handle_nick_in_use(Network& net, const IrcMessage&) {
+    std::string new_nick = net.nickname + generate_random_number_string(12 - net.nickname.length());
+    net.conn->SendData("NICK " + new_nick);
+    net.nickname = new_nick;
+    ui.print(NC_YELLOW) << net.label << "Nickname in use. Changed to: " << new_nick << std::endl;
+    return true;
+}
+
+// PING response
+bool telnIRC::handle_ping(Network& net, const IrcMessage& msg) {
+    net.conn->SendData("PONG :" + std::string(msg.param(0)));
+    return true;
+}
+
+// JOIN message
+bool telnIRC::handle_join(Network& net, const IrcMessage& msg) {
+    std::string_view channel = msg.param(0);
+    if (msg.nick() != net.nickname || channel.empty() || channel.front() != '#')
+        return false;
+
+    setCurrentBuffer(net, std::string(channel), "Current buffer updated to channel: ");
+    return true;
+}
 
-    // JOIN message
-    if (std::regex_search(parsed_line, match, std::regex("^:" + nickname + "!.* JOIN (#[^\\s]+)"))) {
-        if (currentBuffer != match[1]) {
-            currentBuffer = match[1];
-            ui.print(NC_YELLOW) << "Current buffer updated to channel: " << currentBuffer << std::endl;
-            ui.setHeader("Current buffer: " + currentBuffer);
+// NICK change
+bool telnIRC::handle_nick(Network& net, const IrcMessage& msg) {
+    if (msg.param_count == 0)
+        return false;
+
+    if (msg.nick() != net.nickname) {
+        // A query follows its nick instead of a second buffer being opened for the new one.
+        std::string_view to = msg.params[0];
+        size_t id;
+        {
+            std::lock_guard<std::mutex> lock(bufferMutex);
+            auto from = net.buffers.find(msg.nick());
+            if (from == net.buffers.end())
+                return false;
+            id = from->second;
+            auto existing = net.buffers.find(to);
+            if (existing != net.buffers.end() && existing->second != id)
+                return false;  // Both nicks have a buffer; leave them be.
+            net.buffers.erase(from);
+            net.buffers.emplace(to, id);
+            windows[id].target = to;
         }
+        ui.renameBuffer(id, qualified(net, std::string(to)));
         return true;
     }
 
-    // NICK change
-    if (std::regex_search(parsed_line, match, std::regex("^:" + nickname + "!.* NICK :(.*)$"))) {
-        nickname = match[1];
-        ui.print(NC_YELLOW) << "Nickname updated to: " << nickname << std::endl;
-        return true;
-    }
+    net.nickname = msg.params[0];
+    ui.print(NC_YELLOW) << net.label << "Nickname updated to: " << net.nickname << std::endl;
+    return true;
+}
+
+// PART of ours: the channel's buffer is closed and its slot reused.
+bool telnIRC::handle_part(Network& net, const IrcMessage& msg) {
+    if (msg.nick() != net.nickname)
+        return false;
+    size_t id = bufferFor(net, msg.param(0), false);
+    if (id == STATUS_BUFFER)
+        return false;
+    closeWindow(id);
+    return true;
+}
+
+// CAP messages
+bool telnIRC::handle_cap(Network& net, const IrcMessage& msg) {
+    std::string_view subcommand = msg.param(1);
 
-    // CAP messages
-    if (std::regex_search(parsed_line, match, std::regex("^:[^\\s]+ CAP [^\\s]+ LS :(.*)$")) && use_cap) {
-        conn->SendData("CAP REQ :" + std::string(match[1]));
+    if (subcommand == "LS" && msg.param_count == 3 && net.use_cap) {
+        net.conn->SendData("CAP REQ :" + std::string(msg.params[2]));
         return true;
     }
 
-    if (std::regex_search(parsed_line, std::regex("^:[^\\s]+ CAP [^\\s]+ ACK .*$"))) {
-        conn->SendData("CAP END");
+    if (subcommand == "ACK") {
+        net.conn->SendData("CAP END");
         return true;
     }
 
@@ -270,7 +618,12 @@ void telnIRC::show_help() {
     ui.print(NC_YELLOW) << "/q message       - Quits with the specified message" << std::endl;
     ui.print(NC_YELLOW) << "/n newnick       - Change your nickname" << std::endl;
     ui.print(NC_YELLOW) << "/w nickname      - Whois a nickname" << std::endl;
-    ui.print(NC_YELLOW) << "/msg user msg    - Send a private message to a user or channel (updates currentBuffer)" << std::endl;
-    ui.print(NC_YELLOW) << "/sb user/channel - Set the current buffer to a user or channel" << std::endl;
+    ui.print(NC_YELLOW) << "/msg user msg    - Send a private message to a user or channel (switches to its buffer)" << std::endl;
+    ui.print(NC_YELLOW) << "/sb user/channel - Switch to the buffer of a user or channel" << std::endl;
+    ui.print(NC_YELLOW) << "/sb [number]     - List buffers with unread counts, or switch to one (^N/^P also switch)" << std::endl;
+    ui.print(NC_YELLOW) << "/close [target]  - Close the current buffer, or a user's or channel's" << std::endl;
+    ui.print(NC_YELLOW) << "                   With several networks, /msg and /sb take network/target" << std::endl;
+    ui.print(NC_YELLOW) << "/net [network]   - List networks, or make one current" << std::endl;
+    ui.print(NC_YELLOW) << "/stats           - Show latency histograms and I/O counters" << std::endl;
     ui.print(NC_YELLOW) << "/h               - Show this help message" << std::endl;
 }
\ No newline at end of file
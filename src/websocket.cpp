@@ -0,0 +1,205 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <openssl/rand.h>
+
+#include "websocket.h"
+
+void WsMaskSource::Next(unsigned char key[4]) {
+    if (pos == sizeof(pool)) {
+        RAND_bytes(pool, sizeof(pool));
+        pos = 0;
+    }
+    std::memcpy(key, pool + pos, 4);
+    pos += 4;
+}
+
+void ws_mask(char* out, const char* in, size_t len, const unsigned char key[4], size_t phase) {
+    // Rotate the key so byte 0 of the wide word lines up with payload offset 'phase'.
+    unsigned char rotated[8];
+    for (size_t i = 0; i < 8; ++i)
+        rotated[i] = key[(phase + i) & 3];
+    uint64_t wide;
+    std::memcpy(&wide, rotated, sizeof(wide));
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, in + i, sizeof(word));
+        word ^= wide;
+        std::memcpy(out + i, &word, sizeof(word));
+    }
+    for (; i < len; ++i)
+        out[i] = static_cast<char>(in[i] ^ rotated[i & 7]);
+}
+
+void ws_encode_frame(std::string& out, unsigned char opcode, std::string_view payload, WsMaskSource& masks,
+                     bool compressed) {
+    size_t len = payload.size();
+    unsigned char header[14];
+    size_t header_len = 0;
+
+    header[header_len++] = static_cast<unsigned char>(0x80 | (compressed ? 0x40 : 0) | opcode); // FIN, RSV1
+    if (len < 126) {
+        header[header_len++] = static_cast<unsigned char>(0x80 | len);
+    } else if (len <= 0xFFFF) {
+        header[header_len++] = 0x80 | 126;
+        header[header_len++] = static_cast<unsigned char>(len >> 8);
+        header[header_len++] = static_cast<unsigned char>(len);
+    } else {
+        header[header_len++] = 0x80 | 127;
+        for (int i = 7; i >= 0; --i)
+            header[header_len++] = static_cast<unsigned char>(len >> (i * 8));
+    }
+
+    unsigned char* key = header + header_len;
+    masks.Next(key);
+    header_len += 4;
+
+    size_t start = out.size();
+    out.resize(start + header_len + len);
+    std::memcpy(out.data() + start, header, header_len);
+    ws_mask(out.data() + start + header_len, payload.data(), len, key);
+}
+
+WsDecoder::Event WsDecoder::Fail(const char* reason) {
+    error = reason;
+    return Event::Error;
+}
+
+WsDecoder::Event WsDecoder::Next(char* data, size_t len, size_t& consumed) {
+    consumed = 0;
+    payload = std::string_view();
+
+    for (;;) {
+        if (!in_frame) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(data + consumed);
+            size_t avail = len - consumed;
+            if (avail < 2)
+                return Event::NeedMore;
+
+            size_t header_len = 2;
+            uint64_t length = p[1] & 0x7F;
+            if (length == 126) {
+                header_len = 4;
+                if (avail < header_len)
+                    return Event::NeedMore;
+                length = (static_cast<uint64_t>(p[2]) << 8) | p[3];
+            } else if (length == 127) {
+                header_len = 10;
+                if (avail < header_len)
+                    return Event::NeedMore;
+                length = 0;
+                for (int i = 0; i < 8; ++i)
+                    length = (length << 8) | p[2 + i];
+            }
+            bool is_masked = (p[1] & 0x80) != 0;
+            if (is_masked)
+                header_len += 4;
+            if (avail < header_len)
+                return Event::NeedMore;
+
+            fin = (p[0] & 0x80) != 0;
+            opcode = p[0] & 0x0F;
+            unsigned char rsv = p[0] & 0x70;
+            masked = is_masked;
+            if (masked)
+                std::memcpy(mask, p + header_len - 4, 4);
+
+            if (opcode >= WS_OPCODE_CLOSE) {
+                if (!fin || length > 125)
+                    return Fail("fragmented or oversized control frame");
+                if (rsv)
+                    return Fail("RSV bits set on a control frame");
+                control.clear();
+            } else if (opcode == WS_OPCODE_CONTINUATION) {
+                if (!in_message)
+                    return Fail("continuation frame without a message");
+                if (rsv)
+                    return Fail("RSV bits set on a continuation frame");
+            } else if (opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BINARY) {
+                if (in_message)
+                    return Fail("new message inside a fragmented message");
+                if (rsv & ~(allow_compression ? 0x40 : 0))
+                    return Fail("unexpected RSV bits");
+                message_compressed = (rsv & 0x40) != 0;
+                message.clear();
+            } else {
+                return Fail("unknown opcode");
+            }
+            // Written so that a 64-bit length on a continuation frame cannot wrap the sum.
+            if (opcode < WS_OPCODE_CLOSE && length > WS_MAX_MESSAGE - message.size())
+                return Fail("message too large");
+
+            consumed += header_len;
+            remaining = length;
+            phase = 0;
+            in_frame = true;
+
+            // Fast path: a whole unfragmented message is already buffered, so hand it out in place.
+            if (fin && opcode != WS_OPCODE_CONTINUATION && opcode < WS_OPCODE_CLOSE && len - consumed >= remaining) {
+                char* body = data + consumed;
+                if (masked)
+                    ws_mask(body, body, remaining, mask);
+                payload = std::string_view(body, remaining);
+                consumed += remaining;
+                in_frame = false;
+                return Event::Message;
+            }
+        }
+
+        size_t n = static_cast<size_t>(std::min<uint64_t>(remaining, len - consumed));
+        if (n == 0 && remaining > 0)
+            return Event::NeedMore;
+
+        char* body = data + consumed;
+        if (masked)
+            ws_mask(body, body, n, mask, phase);
+        (opcode >= WS_OPCODE_CLOSE ? control : message).append(body, n);
+        consumed += n;
+        phase += n;
+        remaining -= n;
+        if (remaining > 0)
+            return Event::NeedMore;
+        in_frame = false;
+
+        switch (opcode) {
+        case WS_OPCODE_CLOSE:
+            payload = control;
+            return Event::Close;
+        case WS_OPCODE_PING:
+            payload = control;
+            return Event::Ping;
+        case WS_OPCODE_PONG:
+            payload = control;
+            return Event::Pong;
+        default:
+            if (!fin) {
+                in_message = true;
+                continue;
+            }
+            in_message = false;
+            payload = message;
+            return Event::Message;
+        }
+    }
+}
@@ -0,0 +1,195 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+
+#include "wsdeflate.h"
+
+// Every flushed message ends in an empty stored block; RFC 7692 strips it on the wire.
+static const unsigned char deflate_tail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+static uint64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+        s.remove_suffix(1);
+    return s;
+}
+
+std::string ws_deflate_offer(const WsDeflateConfig& offer) {
+    std::string value = "permessage-deflate; client_max_window_bits";
+    if (offer.client_max_window_bits < WS_DEFLATE_MAX_WINDOW_BITS)
+        value += "=" + std::to_string(offer.client_max_window_bits);
+    if (offer.server_max_window_bits < WS_DEFLATE_MAX_WINDOW_BITS)
+        value += "; server_max_window_bits=" + std::to_string(offer.server_max_window_bits);
+    if (offer.client_no_context_takeover)
+        value += "; client_no_context_takeover";
+    if (offer.server_no_context_takeover)
+        value += "; server_no_context_takeover";
+    return value;
+}
+
+bool ws_deflate_accept(std::string_view response, const WsDeflateConfig& offer, WsDeflateConfig& agreed) {
+    agreed = WsDeflateConfig();
+    response = trim(response);
+    if (response.empty())
+        return true;
+
+    bool first = true;
+    agreed = offer;
+    while (!response.empty()) {
+        size_t semi = response.find(';');
+        std::string_view param = trim(response.substr(0, semi));
+        response.remove_prefix(semi == std::string_view::npos ? response.size() : semi + 1);
+
+        if (first) {
+            if (param != "permessage-deflate")
+                return false;
+            first = false;
+            continue;
+        }
+
+        std::string_view name = param, value;
+        size_t eq = param.find('=');
+        if (eq != std::string_view::npos) {
+            name = trim(param.substr(0, eq));
+            value = trim(param.substr(eq + 1));
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                value = value.substr(1, value.size() - 2);
+        }
+
+        if (name == "client_no_context_takeover") {
+            agreed.client_no_context_takeover = true;
+        } else if (name == "server_no_context_takeover") {
+            agreed.server_no_context_takeover = true;
+        } else if (name == "client_max_window_bits" || name == "server_max_window_bits") {
+            int bits = std::atoi(std::string(value).c_str());
+            if (bits < 8 || bits > WS_DEFLATE_MAX_WINDOW_BITS)
+                return false;
+            if (name == "client_max_window_bits") {
+                // Never below what zlib can honour; an 8-bit request cannot be met.
+                if (bits < WS_DEFLATE_MIN_WINDOW_BITS)
+                    return false;
+                agreed.client_max_window_bits = std::min(agreed.client_max_window_bits, bits);
+            } else {
+                if (bits > offer.server_max_window_bits)
+                    return false;
+                agreed.server_max_window_bits = bits;
+            }
+        } else {
+            return false;
+        }
+    }
+    agreed.enabled = true;
+    return true;
+}
+
+WsDeflate::~WsDeflate() {
+    if (active) {
+        deflateEnd(&deflater);
+        inflateEnd(&inflater);
+    }
+}
+
+bool WsDeflate::Init(const WsDeflateConfig& agreed) {
+    if (active || !agreed.enabled)
+        return false;
+    config = agreed;
+    // Negative window bits select a raw stream without zlib headers.
+    if (deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -config.client_max_window_bits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    // The server may use any window up to the agreed size; a full window inflates all of them.
+    if (inflateInit2(&inflater, -WS_DEFLATE_MAX_WINDOW_BITS) != Z_OK) {
+        deflateEnd(&deflater);
+        return false;
+    }
+    active = true;
+    return true;
+}
+
+bool WsDeflate::Compress(std::string_view in, std::string& out) {
+    uint64_t start = thread_cpu_ns();
+    out.clear();
+    deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    deflater.avail_in = static_cast<uInt>(in.size());
+
+    size_t used = 0;
+    do {
+        out.resize(used + deflateBound(&deflater, deflater.avail_in) + 16);
+        deflater.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+        deflater.avail_out = static_cast<uInt>(out.size() - used);
+        if (deflate(&deflater, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+            return false;
+        used = out.size() - deflater.avail_out;
+    } while (deflater.avail_out == 0);
+    out.resize(used);
+
+    if (out.size() >= 4 && out.compare(out.size() - 4, 4, reinterpret_cast<const char*>(deflate_tail), 4) == 0)
+        out.resize(out.size() - 4);
+    if (config.client_no_context_takeover)
+        deflateReset(&deflater);
+
+    stats.raw_out += in.size();
+    stats.wire_out += out.size();
+    stats.deflate_ns += thread_cpu_ns() - start;
+    return true;
+}
+
+bool WsDeflate::Decompress(std::string_view in, std::string& out, size_t max_size) {
+    uint64_t start = thread_cpu_ns();
+    out.clear();
+
+    // Feed the message, then the stripped tail, so inflate() reaches the sync point.
+    std::string_view pieces[2] = { in, std::string_view(reinterpret_cast<const char*>(deflate_tail), 4) };
+    size_t used = 0;
+    for (std::string_view piece : pieces) {
+        inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(piece.data()));
+        inflater.avail_in = static_cast<uInt>(piece.size());
+        do {
+            if (out.size() - used < 4096)
+                out.resize(std::max<size_t>(out.size() * 2, used + 4096));
+            inflater.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+            inflater.avail_out = static_cast<uInt>(out.size() - used);
+            int ret = inflate(&inflater, Z_SYNC_FLUSH);
+            used = out.size() - inflater.avail_out;
+            if (ret == Z_STREAM_END)
+                inflateReset(&inflater); // The peer closed its deflate stream (BFINAL); a new one follows.
+            else if (ret != Z_OK && ret != Z_BUF_ERROR)
+                return false;
+            if (used > max_size)
+                return false;
+        } while (inflater.avail_in > 0 || inflater.avail_out == 0);
+    }
+    out.resize(used);
+    // The inflate window is kept even with server_no_context_takeover: a server that resets its
+    // compressor never refers back to it, so keeping it is harmless and tolerates one that does not.
+
+    stats.wire_in += in.size();
+    stats.raw_in += out.size();
+    stats.inflate_ns += thread_cpu_ns() - start;
+    return true;
+}
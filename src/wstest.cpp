@@ -0,0 +1,100 @@
+/**
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+// WebSocket frame decoder checks, run with `make check`.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "websocket.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++failures; \
+        } \
+    } while (0)
+
+// Appends an unmasked server frame header; 'length' may claim more payload than follows.
+static void frame_header(std::string& out, bool fin, unsigned char opcode, uint64_t length) {
+    out += static_cast<char>((fin ? 0x80 : 0) | opcode);
+    if (length < 126) {
+        out += static_cast<char>(length);
+    } else if (length <= 0xFFFF) {
+        out += static_cast<char>(126);
+        out += static_cast<char>(length >> 8);
+        out += static_cast<char>(length & 0xFF);
+    } else {
+        out += static_cast<char>(127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out += static_cast<char>((length >> shift) & 0xFF);
+    }
+}
+
+static void frame(std::string& out, bool fin, unsigned char opcode, const std::string& payload) {
+    frame_header(out, fin, opcode, payload.size());
+    out += payload;
+}
+
+static void test_fragmented_message() {
+    std::string data;
+    frame(data, false, WS_OPCODE_TEXT, "PING ");
+    frame(data, true, WS_OPCODE_CONTINUATION, ":abc");
+
+    WsDecoder decoder;
+    size_t consumed = 0;
+    CHECK(decoder.Next(data.data(), data.size(), consumed) == WsDecoder::Event::Message);
+    CHECK(decoder.Payload() == "PING :abc");
+    CHECK(consumed == data.size());
+}
+
+static void test_oversized_frame() {
+    std::string data;
+    frame_header(data, true, WS_OPCODE_TEXT, WS_MAX_MESSAGE + 1);
+
+    WsDecoder decoder;
+    size_t consumed = 0;
+    CHECK(decoder.Next(data.data(), data.size(), consumed) == WsDecoder::Event::Error);
+}
+
+// A 64-bit continuation length must not wrap the reassembled size past the cap.
+static void test_huge_continuation_length() {
+    std::string data;
+    frame(data, false, WS_OPCODE_TEXT, "hello");
+    frame_header(data, true, WS_OPCODE_CONTINUATION, UINT64_MAX - 2);
+
+    WsDecoder decoder;
+    size_t consumed = 0;
+    CHECK(decoder.Next(data.data(), data.size(), consumed) == WsDecoder::Event::Error);
+    CHECK(std::string(decoder.Error()) == "message too large");
+}
+
+int main() {
+    test_fragmented_message();
+    test_oversized_frame();
+    test_huge_continuation_length();
+
+    if (failures)
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}